@@ -0,0 +1,224 @@
+// Batch mode: runs the jobs listed in a manifest on a pool of worker
+// threads.  Each manifest line names a program, an input file and an
+// output file, separated by tabs so the names may contain spaces; lines
+// without a tab are split on white space instead.  Programs are compiled
+// once and shared by every job that runs them, and tapes are recycled
+// between jobs.
+//
+// The including JIT provides compile(), which returns NULL for programs
+// that cannot be read, parsed or compiled.
+
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Compiled code takes the cell pointer, the streams, an address to start
+// at (NULL for the beginning) and the fuel for sandboxed code, and
+// returns the fuel left over.
+typedef long (*bf_fn)(uint8_t *ptr, FILE *in, FILE *out, const void *entry,
+                      long fuel);
+
+static bf_fn compile(const char * const filename);
+
+struct job {
+	char *program;
+	char *input;
+	char *output;
+};
+
+// Compiled programs, keyed by file name.  An entry is inserted before its
+// program is compiled; other workers wanting it wait until ready is set.
+struct cached_program {
+	char *program;
+	bf_fn code;
+	int ready;
+	struct cached_program *next;
+};
+
+// Zeroed tapes available for reuse.
+struct free_tape {
+	struct free_tape *next;
+};
+
+struct batch {
+	struct job *jobs;
+	int num_jobs;
+	int next_job;
+	int failed;
+	struct cached_program *cache;
+	struct free_tape *tapes;
+	pthread_mutex_t lock;
+	pthread_cond_t compiled;
+};
+
+static bf_fn batch_lookup(struct batch * const b, const char * const program)
+{
+	struct cached_program *c;
+
+	pthread_mutex_lock(&b->lock);
+	for (c = b->cache; c; c = c->next)
+		if (!strcmp(c->program, program)) break;
+	if (c) {
+		while (!c->ready)
+			pthread_cond_wait(&b->compiled, &b->lock);
+		pthread_mutex_unlock(&b->lock);
+		return c->code;
+	}
+	c = calloc(1, sizeof(*c));
+	if (c == NULL) err("Out of memory");
+	c->program = strdup(program);
+	c->next = b->cache;
+	b->cache = c;
+	pthread_mutex_unlock(&b->lock);
+
+	bf_fn code = compile(program);
+
+	pthread_mutex_lock(&b->lock);
+	c->code = code;
+	c->ready = 1;
+	pthread_cond_broadcast(&b->compiled);
+	pthread_mutex_unlock(&b->lock);
+	return code;
+}
+
+static uint8_t *batch_get_tape(struct batch * const b)
+{
+	pthread_mutex_lock(&b->lock);
+	struct free_tape *t = b->tapes;
+	if (t) b->tapes = t->next;
+	pthread_mutex_unlock(&b->lock);
+	if (t == NULL)
+		return calloc(30000, 1);
+	t->next = NULL;
+	return (uint8_t *) t;
+}
+
+static void batch_put_tape(struct batch * const b, uint8_t * const tape)
+{
+	memset(tape, 0, 30000);
+	struct free_tape *t = (struct free_tape *) tape;
+	pthread_mutex_lock(&b->lock);
+	t->next = b->tapes;
+	b->tapes = t;
+	pthread_mutex_unlock(&b->lock);
+}
+
+static int batch_run_job(struct batch * const b, const struct job * const job)
+{
+	bf_fn code = batch_lookup(b, job->program);
+	if (code == NULL) return -1;
+
+	FILE *in = fopen(job->input, "rb");
+	if (in == NULL) return -1;
+	FILE *out = fopen(job->output, "wb");
+	if (out == NULL) {
+		fclose(in);
+		return -1;
+	}
+	uint8_t *tape = batch_get_tape(b);
+	if (tape == NULL) err("Out of memory");
+	code(tape, in, out, NULL, 0);
+	batch_put_tape(b, tape);
+	fclose(in);
+	return fclose(out) ? -1 : 0;
+}
+
+static void *batch_worker(void *arg)
+{
+	struct batch *b = arg;
+	for (;;) {
+		pthread_mutex_lock(&b->lock);
+		int i = b->next_job++;
+		pthread_mutex_unlock(&b->lock);
+		if (i >= b->num_jobs) return NULL;
+
+		if (batch_run_job(b, &b->jobs[i])) {
+			fprintf(stderr, "job %d (%s) failed\n",
+			        i + 1, b->jobs[i].program);
+			pthread_mutex_lock(&b->lock);
+			b->failed++;
+			pthread_mutex_unlock(&b->lock);
+		}
+	}
+}
+
+// Fills in job from a manifest line.  Returns the number of fields on
+// the line, which must be 3, or 0 for a blank line.
+static int batch_parse(char * const line, struct job * const job)
+{
+	if (!strchr(line, '\t'))
+		return sscanf(line, "%ms %ms %ms",
+		              &job->program, &job->input, &job->output);
+
+	char **fields[3] = { &job->program, &job->input, &job->output };
+	char *rest = line, *field;
+	int n = 0;
+	line[strcspn(line, "\n")] = '\0';
+	while (n < 3 && (field = strsep(&rest, "\t")) != NULL)
+		if ((*fields[n++] = strdup(field)) == NULL)
+			err("Out of memory");
+	return rest ? n + 1 : n;
+}
+
+// Runs every job in the manifest on num_threads workers.  Returns the
+// number of jobs that failed.
+static int batch_run(const char * const manifest, int num_threads)
+{
+	struct batch b = {
+		.lock = PTHREAD_MUTEX_INITIALIZER,
+		.compiled = PTHREAD_COND_INITIALIZER,
+	};
+	FILE *fp = fopen(manifest, "r");
+	if (fp == NULL) err("Couldn't open manifest");
+
+	char *line = NULL;
+	size_t line_size = 0;
+	int cap = 0;
+	while (getline(&line, &line_size, fp) != -1) {
+		struct job job;
+		int n = batch_parse(line, &job);
+		if (n <= 0) continue;
+		if (n != 3)
+			err("Manifest lines need: program, input and output, "
+			    "separated by tabs");
+		if (b.num_jobs == cap) {
+			cap = cap ? cap * 2 : 64;
+			b.jobs = realloc(b.jobs, cap * sizeof(*b.jobs));
+			if (b.jobs == NULL) err("Out of memory");
+		}
+		b.jobs[b.num_jobs++] = job;
+	}
+	free(line);
+	fclose(fp);
+
+	if (num_threads > b.num_jobs) num_threads = b.num_jobs;
+	pthread_t *threads = calloc(num_threads, sizeof(*threads));
+	for (int i = 0; i < num_threads; i++)
+		if (pthread_create(&threads[i], NULL, batch_worker, &b))
+			err("Couldn't create worker thread");
+	for (int i = 0; i < num_threads; i++)
+		pthread_join(threads[i], NULL);
+	free(threads);
+
+	for (int i = 0; i < b.num_jobs; i++) {
+		free(b.jobs[i].program);
+		free(b.jobs[i].input);
+		free(b.jobs[i].output);
+	}
+	free(b.jobs);
+	while (b.cache) {
+		struct cached_program *c = b.cache;
+		b.cache = c->next;
+		if (c->code) free_jitcode(c->code);
+		free(c->program);
+		free(c);
+	}
+	while (b.tapes) {
+		struct free_tape *t = b.tapes;
+		b.tapes = t->next;
+		free(t);
+	}
+	return b.failed;
+}
@@ -0,0 +1,117 @@
+// Client for the jit-x64 daemon (jit-x64 -d <socket>, see served.h).  A
+// drop-in for jit-x64 <inputfile>: the program runs on the daemon with
+// this process's input, and its output is streamed back.  The socket is
+// taken from $BF_SERVED, or BF_SERVED_SOCKET by default.
+
+#include <errno.h>
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#include "util.h"
+
+#define BF_SERVED_SOCKET "/tmp/bf-served.sock"
+
+static void write_all(const int fd, const char *buf, size_t len)
+{
+	while (len) {
+		ssize_t n = write(fd, buf, len);
+		if (n < 0 && errno == EINTR) continue;
+		if (n <= 0) err("Lost connection to the daemon");
+		buf += n;
+		len -= n;
+	}
+}
+
+int main(int argc, char *argv[])
+{
+	if (argc != 2) err("Usage: bf-client <inputfile>");
+	char *source = read_file(argv[1]);
+	if (source == NULL) err("Couldn't open file");
+
+	const char *path = getenv("BF_SERVED");
+	if (path == NULL) path = BF_SERVED_SOCKET;
+	struct sockaddr_un addr = { .sun_family = AF_UNIX };
+	if (strlen(path) >= sizeof(addr.sun_path)) err("Socket path too long");
+	strcpy(addr.sun_path, path);
+	int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (fd < 0 || connect(fd, (struct sockaddr *) &addr, sizeof(addr)))
+		err("Couldn't connect to the daemon");
+
+	char header[32];
+	size_t len = strlen(source);
+	write_all(fd, header, snprintf(header, sizeof(header), "%zu\n", len));
+	write_all(fd, source, len);
+	free(source);
+
+	// Forward input until it runs out, and the reply until the daemon
+	// hangs up: output chunks, each '+', a length and a newline before
+	// the bytes, then '.' if the program finished or '-' and a message.
+	struct pollfd fds[2] = {
+		{ .fd = fd, .events = POLLIN },
+		{ .fd = STDIN_FILENO, .events = POLLIN },
+	};
+	enum { TAG, LENGTH, CHUNK, MESSAGE, END } state = TAG;
+	int nfds = 2, status = 0;
+	size_t left = 0;
+	char buf[1 << 16];
+	for (;;) {
+		if (poll(fds, nfds, -1) < 0) {
+			if (errno == EINTR) continue;
+			err("poll failed");
+		}
+		if (nfds == 2 && fds[1].revents) {
+			ssize_t n = read(STDIN_FILENO, buf, sizeof(buf));
+			if (n > 0) {
+				write_all(fd, buf, n);
+			} else {
+				shutdown(fd, SHUT_WR);
+				nfds = 1;
+			}
+		}
+		if (fds[0].revents) {
+			ssize_t n = read(fd, buf, sizeof(buf));
+			if (n < 0 && errno == EINTR) continue;
+			if (n <= 0) break;
+			for (char *p = buf, *end = buf + n; p < end; ) {
+				char *nl;
+				size_t m;
+				switch (state) {
+				case TAG:
+					if (*p == '+') state = LENGTH;
+					else if (*p == '-') state = MESSAGE;
+					else if (*p == '.') state = END;
+					else err("Bad reply from the daemon");
+					status = *p++ == '-';
+					break;
+				case LENGTH:
+					if (*p == '\n') state = CHUNK;
+					else left = left * 10 + *p - '0';
+					p++;
+					break;
+				case CHUNK:
+					m = (size_t) (end - p) < left ? end - p : left;
+					write_all(STDOUT_FILENO, p, m);
+					p += m;
+					if (!(left -= m)) state = TAG;
+					break;
+				case MESSAGE:
+					nl = memchr(p, '\n', end - p);
+					m = nl ? nl + 1 - p : end - p;
+					write_all(STDERR_FILENO, p, m);
+					p += m;
+					if (nl) state = END;
+					break;
+				case END:
+					err("Bad reply from the daemon");
+				}
+			}
+		}
+	}
+	close(fd);
+	if (state != END) err("Lost connection to the daemon");
+	return status;
+}
@@ -0,0 +1,21 @@
+// Interface of programs compiled into shared objects with compiler-x64 -l:
+//
+//   ./compiler-x64 -l prog.b > prog.s && gcc -shared -o prog.so prog.s
+//
+// Each shared object exports bf_run(), found with dlsym(handle, "bf_run").
+// The code keeps no state of its own, so one loaded program can run on
+// many threads at once, each with its own tape and callbacks.
+
+#include <stdint.h>
+
+struct bf_io {
+	void (*put)(int c, void *ctx); // called for every '.'
+	int (*get)(void *ctx);         // called for every ','; the cell
+	                               // keeps the low 8 bits, so EOF is 255
+	void *ctx;
+};
+
+// Runs the program on tape, which must hold 30000 cells, zeroed for a
+// fresh run.
+typedef void (*bf_run_fn)(uint8_t *tape, const struct bf_io *io);
+void bf_run(uint8_t *tape, const struct bf_io *io);
@@ -0,0 +1,143 @@
+// Checkpoints: a running program's state, saved at a loop back-edge so the
+// job can be resumed later, on this machine or another.
+//
+// With checkpointing on, SIGTERM and SIGINT save a checkpoint at the next
+// back-edge and exit with CHECKPOINT_EXIT, and SIGUSR1 saves one and keeps
+// going.  A checkpoint records the tape, the pointer, the back-edge, and
+// how much input has been read and output written.  Resuming skips the
+// input already read.  If stdout is a regular file, resuming cuts it back
+// to the recorded length first, so resuming into the same file (opened
+// with >> or 1<>) produces the output exactly once.
+//
+// Uses err() from util.h.
+//
+// The file is one text line of header followed by the tape with runs of
+// zeros compressed, up to its last nonzero cell:
+//   bf-checkpoint <tool> <program hash> <pc> <pointer> <input> <output>
+
+#include <errno.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define CHECKPOINT_TAPE 30000
+// Exit status after saving a checkpoint and stopping: EX_TEMPFAIL, so a
+// scheduler knows to run the job again.
+#define CHECKPOINT_EXIT 75
+
+enum { CHECKPOINT_NONE, CHECKPOINT_SAVE, CHECKPOINT_STOP };
+
+struct checkpoint {
+	const char *tool; // which program wrote it; pc means different things
+	uint64_t program; // hash of the program source
+	long pc;
+	long ptr; // offset into the tape
+	long in, out; // bytes of input read and output written
+	uint8_t tape[CHECKPOINT_TAPE];
+};
+
+// Set from signal handlers; polled at back-edges.
+static volatile sig_atomic_t checkpoint_requested;
+
+static void checkpoint_signal(int sig)
+{
+	checkpoint_requested = sig == SIGUSR1 ? CHECKPOINT_SAVE
+	                                      : CHECKPOINT_STOP;
+}
+
+static inline
+void checkpoint_signals(void)
+{
+	struct sigaction action = { .sa_handler = checkpoint_signal,
+	                            .sa_flags = SA_RESTART };
+	sigemptyset(&action.sa_mask);
+	sigaction(SIGTERM, &action, NULL);
+	sigaction(SIGINT, &action, NULL);
+	sigaction(SIGUSR1, &action, NULL);
+}
+
+// Writes c to filename, replacing it only once the new one is complete.
+static inline
+void checkpoint_save(const char * const filename,
+                     const struct checkpoint * const c)
+{
+	char tmp[4096];
+	snprintf(tmp, sizeof(tmp), "%s.tmp", filename);
+	FILE *fp = fopen(tmp, "wb");
+	if (fp == NULL) err("Couldn't write checkpoint");
+
+	fprintf(fp, "bf-checkpoint %s %016llx %ld %ld %ld %ld\n", c->tool,
+	        (unsigned long long) c->program, c->pc, c->ptr, c->in, c->out);
+	int len = CHECKPOINT_TAPE;
+	while (len > 0 && c->tape[len - 1] == 0)
+		len--;
+	for (int i = 0; i < len; ) {
+		if (c->tape[i]) {
+			putc(c->tape[i++], fp);
+			continue;
+		}
+		// A zero byte is followed by the length of its run.
+		int run = 0;
+		while (i < len && c->tape[i] == 0 && run < 255)
+			i++, run++;
+		putc(0, fp);
+		putc(run, fp);
+	}
+	if (fflush(fp) || fsync(fileno(fp)) || fclose(fp) ||
+	    rename(tmp, filename))
+		err("Couldn't write checkpoint");
+}
+
+// Reads the checkpoint in filename into c, checking it was written by
+// tool for the program with the given hash.
+static inline
+void checkpoint_load(const char * const filename, const char * const tool,
+                     const uint64_t program, struct checkpoint * const c)
+{
+	FILE *fp = fopen(filename, "rb");
+	if (fp == NULL) err("Couldn't read checkpoint");
+	char kind[32];
+	unsigned long long hash;
+	if (fscanf(fp, "bf-checkpoint %31s %llx %ld %ld %ld %ld", kind, &hash,
+	           &c->pc, &c->ptr, &c->in, &c->out) != 6 ||
+	    getc(fp) != '\n')
+		err("Not a checkpoint");
+	if (strcmp(kind, tool) || hash != program)
+		err("Checkpoint is for another program");
+	if (c->ptr < 0 || c->ptr >= CHECKPOINT_TAPE)
+		err("Corrupt checkpoint");
+
+	memset(c->tape, 0, sizeof(c->tape));
+	int len = 0;
+	for (int b; (b = getc(fp)) != EOF; ) {
+		int run = b ? 1 : getc(fp);
+		if (run == EOF || len + run > CHECKPOINT_TAPE)
+			err("Corrupt checkpoint");
+		if (b) c->tape[len] = b;
+		len += run;
+	}
+	fclose(fp);
+	c->tool = tool;
+	c->program = program;
+}
+
+// Positions stdin and stdout for resuming from c: skips the input that
+// was read and cuts a regular stdout back to the output written.
+static inline
+void checkpoint_resume_io(const struct checkpoint * const c)
+{
+	if (fseek(stdin, c->in, SEEK_SET)) {
+		for (long i = 0; i < c->in; i++)
+			if (getchar() == EOF) break;
+	}
+	struct stat st;
+	if (!fstat(STDOUT_FILENO, &st) && S_ISREG(st.st_mode) &&
+	    st.st_size >= c->out) {
+		if (ftruncate(STDOUT_FILENO, c->out))
+			err("Couldn't truncate output");
+		fseek(stdout, c->out, SEEK_SET);
+	}
+}
@@ -1,21 +1,91 @@
 #include <stdio.h>
 #include <stdlib.h>
+#include <unistd.h>
 #include "util.h"
 
-void compile(const char * const file_contents)
+// Size of each I/O buffer of the standalone runtime.
+#define IOBUF_SIZE 65536
+
+// Standalone programs (-s) link without the C library: they start at
+// _start, keep the tape in .bss, and buffer I/O themselves with raw
+// system calls.  R6 is the next free byte of the output buffer and R10
+// its end; R8 and R9 bound the input not read yet.  Link with
+// gcc -nostdlib -static.
+static const char * const standalone_prologue =
+    ".syntax unified\n"
+    ".text\n"
+    ".globl _start\n"
+    "_start:\n"
+    "    MOVW R4, #:lower16:_array\n"
+    "    MOVT R4, #:upper16:_array\n"
+    "    MOVW R6, #:lower16:_outbuf\n"
+    "    MOVT R6, #:upper16:_outbuf\n"
+    "    ADD R10, R6, #IOBUF_SIZE\n"
+    "    MOVW R8, #:lower16:_inbuf\n"
+    "    MOVT R8, #:upper16:_inbuf\n"
+    "    MOV R9, R8\n";
+
+static const char * const standalone_epilogue =
+    "    BL _bf_flush\n"
+    "    MOV R0, #0\n"
+    "    MOV R7, #1\n"      // exit(0)
+    "    SVC #0\n"
+    "\n"
+    // Writes out the output buffer and empties it, dropping what
+    // cannot be written.
+    "_bf_flush:\n"
+    "    SUB R1, R10, #IOBUF_SIZE\n"
+    "1:  SUBS R2, R6, R1\n"
+    "    BEQ 2f\n"
+    "    MOV R0, #1\n"
+    "    MOV R7, #4\n"      // write(1, R1, R2)
+    "    SVC #0\n"
+    "    CMP R0, #0\n"
+    "    BLE 2f\n"
+    "    ADD R1, R1, R0\n"
+    "    B 1b\n"
+    "2:  SUB R6, R10, #IOBUF_SIZE\n"
+    "    BX LR\n"
+    "\n"
+    // Refills the input buffer, flushing the output first so prompts
+    // appear before the program waits.  Leaves it empty at end of input.
+    "_bf_refill:\n"
+    "    PUSH {R0, LR}\n"
+    "    BL _bf_flush\n"
+    "    MOV R0, #0\n"
+    "    MOVW R1, #:lower16:_inbuf\n"
+    "    MOVT R1, #:upper16:_inbuf\n"
+    "    MOV R2, #IOBUF_SIZE\n"
+    "    MOV R7, #3\n"      // read(0, _inbuf, IOBUF_SIZE)
+    "    SVC #0\n"
+    "    MOV R8, R1\n"
+    "    MOV R9, R1\n"
+    "    CMP R0, #0\n"
+    "    ADDGT R9, R9, R0\n"
+    "    POP {R0, PC}\n"
+    "\n"
+    ".lcomm _array, 30000\n"
+    ".lcomm _outbuf, IOBUF_SIZE\n"
+    ".lcomm _inbuf, IOBUF_SIZE\n";
+
+void compile(FILE * const fp, const int standalone)
 {
 	int num_brackets = 0;
 	int matching_bracket = 0;
-	struct stack stack = { .size = 0, .items = { 0 } };
+	struct stack stack = { .size = 0, .items = NULL };
 	const char * const prologue =
 	    ".globl main\n"
 	    "main:\n"
 	    "LDR R4 ,= _array\n"
 	    "push {lr}\n";
-	puts(prologue);
+	if (standalone)
+		printf(".set IOBUF_SIZE, %d\n%s\n", IOBUF_SIZE,
+		       standalone_prologue);
+	else
+		puts(prologue);
 
-	for (unsigned long i = 0; file_contents[i] != '\0'; ++i) {
-		switch (file_contents[i]) {
+	for (int c; (c = getc(fp)) != EOF; ) {
+		switch (c) {
 		case '>':
 			puts("    ADD R4, R4, #1");
 			break;
@@ -33,20 +103,40 @@ void compile(const char * const file_contents)
 			puts("    STRB R5, [R4]");
 			break;
 		case '.':
+			if (standalone) {
+				puts("    LDRB R5, [R4]");
+				puts("    STRB R5, [R6], #1");
+				puts("    CMP R6, R10");
+				puts("    BLEQ _bf_flush");
+				break;
+			}
 			puts("    LDR R0 ,= _char ");
 			puts("    LDRB R1, [R4]");
 			puts("    BL printf");
 			break;
 		case ',':
+			if (standalone) {
+				// At end of input the cell becomes 255, as
+				// getchar()'s EOF does.
+				puts("    CMP R8, R9");
+				puts("    BLEQ _bf_refill");
+				puts("    CMP R8, R9");
+				puts("    LDRBNE R5, [R8], #1");
+				puts("    MOVEQ R5, #255");
+				puts("    STRB R5, [R4]");
+				break;
+			}
 			puts("    BL getchar");
 			puts("    STRB R0, [R4]");
 			break;
 		case '[':
 			if (stack_push(&stack, num_brackets) == 0) {
+				// Rotated loop: enter at the test on the
+				// bottom, so each iteration takes a single
+				// backward branch.
+				printf("    B _out_%d\n", num_brackets);
+				puts  ("    .p2align 4");
 				printf("_in_%d:\n", num_brackets);
-				puts  ("    LDRB R5, [R4]");
-				puts  ("    CMP R5, #0");
-				printf("    BEQ _out_%d\n", num_brackets);
 				num_brackets++;
 			} else {
 				err("out of stack space, too much nesting");
@@ -64,6 +154,11 @@ void compile(const char * const file_contents)
 			break;
 		}
 	}
+	stack_free(&stack);
+	if (standalone) {
+		puts(standalone_epilogue);
+		return;
+	}
 	const char *const epilogue =
 	    "    pop {pc}\n"
 	    ".data\n"
@@ -75,9 +170,14 @@ void compile(const char * const file_contents)
 
 int main(int argc, char *argv[])
 {
-	if (argc != 2) err("Usage: compiler-arm <inputfile>");
-	char *file_contents = read_file(argv[1]);
-	if (file_contents == NULL) err("Unable to read file");
-	compile(file_contents);
-	free(file_contents);
+	int opt, standalone = 0;
+	while ((opt = getopt(argc, argv, "s")) != -1) {
+		if (opt == 's') standalone = 1;
+		else err("Usage: compiler-arm [-s] <inputfile>");
+	}
+	if (optind != argc - 1) err("Usage: compiler-arm [-s] <inputfile>");
+	FILE *fp = open_source(argv[optind]);
+	if (fp == NULL) err("Unable to read file");
+	compile(fp, standalone);
+	fclose(fp);
 }
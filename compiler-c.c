@@ -0,0 +1,110 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include "ir.h"
+
+// Most cells a multiply loop may touch and still be lowered.
+#define MUL_TERMS 16
+
+// Emits C for the C compiler to optimize: the IR's folded runs become
+// single statements, moves between loops fold into the offsets of the
+// cells accessed, and multiply loops become straight-line p[off] +=
+// p[0] * factor statements that it can schedule and vectorize freely.
+
+static int depth = 1;
+
+static void indent(void)
+{
+	for (int i = 0; i < depth; i++)
+		putchar('\t');
+}
+
+// Applies the pointer movement deferred into pos.
+static void flush_move(int * const pos)
+{
+	if (*pos) {
+		indent();
+		printf("p += %d;\n", *pos);
+	}
+	*pos = 0;
+}
+
+void compile(const struct ir_prog * const prog)
+{
+	const char * const prologue =
+	    "#include <stdio.h>\n"
+	    "\n"
+	    "static unsigned char tape[30000];\n"
+	    "\n"
+	    "int main(void)\n"
+	    "{\n"
+	    "\tunsigned char *p = tape;\n";
+	puts(prologue);
+
+	struct ir_mul terms[MUL_TERMS];
+	int pos = 0, n;
+
+	for (int i = 0; i < prog->len; i++) {
+		const struct ir *op = &prog->ops[i];
+		switch (op->op) {
+		case IR_MOVE:
+			pos += op->val;
+			break;
+		case IR_ADD:
+			indent();
+			printf("p[%d] += %d;\n", pos, op->val);
+			break;
+		case IR_SET:
+			indent();
+			printf("p[%d] = %d;\n", pos, op->val);
+			break;
+		case IR_OUT:
+			indent();
+			printf("putchar(p[%d]);\n", pos);
+			break;
+		case IR_IN:
+			// getchar()'s EOF stores 255.
+			indent();
+			printf("p[%d] = getchar();\n", pos);
+			break;
+		case IR_OPEN:
+			if ((n = ir_mul_loop(prog, i, terms, MUL_TERMS)) >= 0) {
+				for (int k = 0; k < n; k++) {
+					indent();
+					printf("p[%d] += p[%d] * %d;\n",
+					       pos + terms[k].off, pos,
+					       terms[k].factor);
+				}
+				indent();
+				printf("p[%d] = 0;\n", pos);
+				i = op->match;
+				break;
+			}
+			flush_move(&pos);
+			indent();
+			// Constant propagation may prove the entry test passes.
+			puts(op->val ? "do {" : "while (*p) {");
+			depth++;
+			break;
+		case IR_CLOSE:
+			flush_move(&pos);
+			depth--;
+			indent();
+			puts(prog->ops[op->match].val ? "} while (*p);" : "}");
+			break;
+		}
+	}
+	puts("\treturn 0;\n}");
+}
+
+int main(int argc, char *argv[])
+{
+	if (argc != 2) err("Usage: compiler-c <inputfile>");
+	FILE *fp = open_source(argv[1]);
+	if (fp == NULL) err("Unable to read file");
+	struct ir_prog prog;
+	if (ir_parse(fp, &prog)) err("unmatched brackets");
+	fclose(fp);
+	ir_propagate(&prog);
+	compile(&prog);
+	ir_free(&prog);
+}
@@ -1,12 +1,309 @@
+#include <ctype.h>
 #include <stdio.h>
 #include <stdlib.h>
-#include "util.h"
+#include <unistd.h>
+#include "ir.h"
+#include "profile.h"
 
-void compile(const char * const text_body)
+// Upper bound on operations run by the compile time pre-execution pass.
+#define PREEVAL_STEPS 100000000L
+// Output after which it stops, give or take PREEVAL_CHUNK bytes, so
+// programs that print a lot do not turn into huge assembly files.
+#define PREEVAL_OUTPUT 65536
+// Operations it runs between looks at the output so far.
+#define PREEVAL_CHUNK 4096
+// Size of each I/O buffer of the standalone runtime.
+#define IOBUF_SIZE 65536
+// Most trips a loop may always make and still be peeled (-g).
+#define UNROLL_MAX 4
+// Fewest cells a [>] or [<] must usually pass to be scanned with SSE2.
+#define SCAN_SIMD_MIN 16
+
+// What the generated code runs on.
+enum mode {
+	MODE_LIBC,       // a main() linked against the C library
+	MODE_STANDALONE, // -s: a static program making its own system calls
+	MODE_LIBRARY,    // -l: bf_run() in a shared object, see bf-run.h
+};
+
+// Standalone programs (-s) link without the C library: they start at
+// _start, keep the tape in .bss, and buffer I/O themselves with raw
+// system calls.  %r13 is the next free byte of the output buffer and
+// %rbx its end; %r14 and %r15 bound the input not read yet.  Link with
+// gcc -nostdlib -static.
+static const char * const standalone_prologue =
+    ".text\n"
+    ".global _start\n"
+    "_start:\n"
+    "    leaq tape(%rip), %r12\n"
+    "    leaq outbuf(%rip), %r13\n"
+    "    leaq IOBUF_SIZE(%r13), %rbx\n"
+    "    leaq inbuf(%rip), %r14\n"
+    "    movq %r14, %r15";
+
+// Library code (-l) is position independent and keeps the caller's tape
+// in %r12 and its struct bf_io in %r13.  %rbx and %r14 are saved for the
+// pre-evaluated output loop.  Assemble with gcc -shared.
+static const char * const library_prologue =
+    ".text\n"
+    ".global bf_run\n"
+    ".type bf_run, @function\n"
+    "bf_run:\n"
+    "    pushq %rbp\n"
+    "    movq %rsp, %rbp\n"
+    "    pushq %r12\n"
+    "    pushq %r13\n"
+    "    pushq %rbx\n"
+    "    pushq %r14\n"
+    "    movq %rdi, %r12\n"
+    "    movq %rsi, %r13";
+
+static const char * const library_epilogue =
+    "    popq %r14\n"
+    "    popq %rbx\n"
+    "    popq %r13\n"
+    "    popq %r12\n"
+    "    popq %rbp\n"
+    "    ret\n"
+    // The I/O stubs and cold loops in subsections 1 and 2 belong to
+    // bf_run too, so its size runs to the end of the last one.
+    ".text 2\n"
+    ".Lbf_run_end:\n"
+    ".text 0\n"
+    ".size bf_run, .Lbf_run_end-bf_run\n"
+    ".section .note.GNU-stack, \"\", @progbits\n";
+
+static const char * const standalone_epilogue =
+    "    call bf_flush\n"
+    "    movl $231, %eax\n" // exit_group(0)
+    "    xorl %edi, %edi\n"
+    "    syscall\n"
+    "\n"
+    // Writes %rdx bytes at %rsi to stdout, dropping them on error.
+    "bf_write:\n"
+    "    testq %rdx, %rdx\n"
+    "    jle 1f\n"
+    "    movl $1, %eax\n"   // write(1, %rsi, %rdx)
+    "    movl $1, %edi\n"
+    "    syscall\n"
+    "    testq %rax, %rax\n"
+    "    jle 1f\n"
+    "    addq %rax, %rsi\n"
+    "    subq %rax, %rdx\n"
+    "    jmp bf_write\n"
+    "1:  ret\n"
+    "\n"
+    "bf_flush:\n"
+    "    leaq outbuf(%rip), %rsi\n"
+    "    movq %r13, %rdx\n"
+    "    subq %rsi, %rdx\n"
+    "    movq %rsi, %r13\n"
+    "    jmp bf_write\n"
+    "\n"
+    // Refills the input buffer, flushing the output first so prompts
+    // appear before the program waits.  Leaves it empty at end of input.
+    "bf_refill:\n"
+    "    call bf_flush\n"
+    "    xorl %eax, %eax\n" // read(0, inbuf, IOBUF_SIZE)
+    "    xorl %edi, %edi\n"
+    "    leaq inbuf(%rip), %rsi\n"
+    "    movl $IOBUF_SIZE, %edx\n"
+    "    syscall\n"
+    "    movq %rsi, %r14\n"
+    "    movq %rsi, %r15\n"
+    "    testq %rax, %rax\n"
+    "    jle 1f\n"
+    "    addq %rax, %r15\n"
+    "1:  ret\n"
+    "\n"
+    ".lcomm tape, 30000\n"
+    ".lcomm outbuf, IOBUF_SIZE\n"
+    ".lcomm inbuf, IOBUF_SIZE\n";
+
+// Prints a byte buffer under the given label, as .ascii directives of
+// up to 64 bytes each.
+static void print_bytes(const char * const label,
+                        const uint8_t * const buf, const size_t len)
+{
+	printf("%s:", label);
+	for (size_t i = 0; i < len; i++) {
+		if (i % 64 == 0)
+			printf("%s    .ascii \"", i ? "\"\n" : "\n");
+		if (buf[i] == '"' || buf[i] == '\\')
+			printf("\\%c", buf[i]);
+		else if (isprint(buf[i]))
+			putchar(buf[i]);
+		else
+			printf("\\%03o", buf[i]);
+	}
+	puts(len ? "\"" : "");
+}
+
+// Runs the input independent prefix of the program, up to its first ',',
+// PREEVAL_STEPS operations or PREEVAL_OUTPUT bytes of output.  Emits the output it produced and the tape
+// it left behind, and code that installs both before jumping to the
+// operation where evaluation stopped.  Returns the index of that
+// operation.
+static int preeval(const struct ir_prog * const prog, const enum mode mode)
+{
+	uint8_t *tape = calloc(30000, 1);
+	uint8_t *ptr = tape;
+	char *output;
+	size_t output_size;
+	long steps = PREEVAL_STEPS;
+	int pc = 0;
+
+	FILE *out = open_memstream(&output, &output_size);
+	if (tape == NULL || out == NULL) err("Out of memory");
+	// Runs in chunks, resuming where each stopped, until one stops
+	// early or the budgets run out.
+	do {
+		long chunk = steps < PREEVAL_CHUNK ? steps : PREEVAL_CHUNK;
+		long left = chunk;
+		pc = ir_eval(prog, pc, tape, 30000, &ptr, NULL, out, &left);
+		steps -= chunk - left;
+		if (left) break;
+		fflush(out); // brings output_size up to date
+	} while (steps > 0 && output_size < PREEVAL_OUTPUT);
+	assert(!fclose(out));
+
+	// Only the part of the tape that was written needs restoring.
+	int tape_size = 30000;
+	while (tape_size > 0 && tape[tape_size - 1] == 0)
+		tape_size--;
+
+	if (tape_size && mode == MODE_STANDALONE) {
+		puts("    leaq tape(%rip), %rdi");
+		puts("    leaq preeval_tape(%rip), %rsi");
+		printf("    movq $%d, %%rcx\n", tape_size);
+		puts("    rep movsb");
+	} else if (tape_size && mode == MODE_LIBRARY) {
+		puts("    movq %r12, %rdi");
+		puts("    leaq preeval_tape(%rip), %rsi");
+		printf("    movq $%d, %%rdx\n", tape_size);
+		puts("    call memcpy@PLT");
+	} else if (tape_size) {
+		puts("    leaq (%rsp), %rdi");
+		puts("    leaq preeval_tape(%rip), %rsi");
+		printf("    movq $%d, %%rdx\n", tape_size);
+		puts("    call memcpy");
+	}
+	if (output_size && mode == MODE_STANDALONE) {
+		puts("    leaq preeval_output(%rip), %rsi");
+		printf("    movq $%zu, %%rdx\n", output_size);
+		puts("    call bf_write");
+	} else if (output_size && mode == MODE_LIBRARY) {
+		puts("    leaq preeval_output(%rip), %rbx");
+		printf("    leaq %zu(%%rbx), %%r14\n", output_size);
+		puts("1:  movzbl (%rbx), %edi");
+		puts("    movq 16(%r13), %rsi");
+		puts("    call *(%r13)");
+		puts("    incq %rbx");
+		puts("    cmpq %r14, %rbx");
+		puts("    jb 1b");
+	} else if (output_size) {
+		puts("    leaq preeval_output(%rip), %rdi");
+		puts("    movq $1, %rsi");
+		printf("    movq $%zu, %%rdx\n", output_size);
+		puts("    movq stdout@GOTPCREL(%rip), %rcx");
+		puts("    movq (%rcx), %rcx");
+		puts("    call fwrite");
+	}
+	printf("    addq $%d, %%r12\n", (int) (ptr - tape));
+	puts("    jmp preeval_resume");
+
+	puts(".section .rodata");
+	print_bytes("preeval_tape", tape, tape_size);
+	print_bytes("preeval_output", (uint8_t *) output, output_size);
+	puts(".text");
+
+	free(output);
+	free(tape);
+	return pc;
+}
+
+// Whether the body of the loop opening at open only moves and changes
+// cells, so that copies of it need no labels of their own.
+static int simple_body(const struct ir_prog * const prog, const int open)
+{
+	for (int i = open + 1; i < prog->ops[open].match; i++)
+		if (prog->ops[i].op != IR_MOVE && prog->ops[i].op != IR_ADD &&
+		    prog->ops[i].op != IR_SET)
+			return 0;
+	return 1;
+}
+
+static void compile_cell_op(const struct ir * const op)
+{
+	if (op->op == IR_MOVE)
+		printf("    addq $%d, %%r12\n", op->val);
+	else if (op->op == IR_ADD)
+		printf("    addb $%d, (%%r12)\n", op->val);
+	else
+		printf("    movb $%d, (%%r12)\n", op->val);
+}
+
+// Moves %r12 to the nearest zero cell in the direction of step, 16 cells
+// at a time.  The aligned loads never cross into another page, so reading
+// past the ends of the tape is harmless.
+static void compile_scan(const int i, const int step)
+{
+	puts  ("    pxor %xmm0, %xmm0");
+	puts  ("    movq %r12, %rsi");
+	puts  ("    andq $-16, %rsi");
+	puts  ("    movl %r12d, %ecx");
+	puts  ("    andl $15, %ecx");
+	// The zero cells of the first block, from the pointer on.
+	puts  ("    movdqa (%rsi), %xmm1");
+	puts  ("    pcmpeqb %xmm0, %xmm1");
+	puts  ("    pmovmskb %xmm1, %eax");
+	if (step > 0) {
+		puts  ("    shrl %cl, %eax");
+		puts  ("    testl %eax, %eax");
+		printf("    jnz scan_%d_near\n", i);
+		printf("scan_%d_next:\n", i);
+		puts  ("    addq $16, %rsi");
+		puts  ("    movdqa (%rsi), %xmm1");
+		puts  ("    pcmpeqb %xmm0, %xmm1");
+		puts  ("    pmovmskb %xmm1, %eax");
+		puts  ("    testl %eax, %eax");
+		printf("    jz scan_%d_next\n", i);
+		puts  ("    bsfl %eax, %eax");
+		puts  ("    leaq (%rsi,%rax), %r12");
+		printf("    jmp scan_%d_done\n", i);
+		printf("scan_%d_near:\n", i);
+		puts  ("    bsfl %eax, %eax");
+		puts  ("    addq %rax, %r12");
+	} else {
+		puts  ("    xorl $15, %ecx");
+		puts  ("    shll %cl, %eax");
+		puts  ("    movzwl %ax, %eax");
+		puts  ("    testl %eax, %eax");
+		printf("    jnz scan_%d_near\n", i);
+		printf("scan_%d_next:\n", i);
+		puts  ("    subq $16, %rsi");
+		puts  ("    movdqa (%rsi), %xmm1");
+		puts  ("    pcmpeqb %xmm0, %xmm1");
+		puts  ("    pmovmskb %xmm1, %eax");
+		puts  ("    testl %eax, %eax");
+		printf("    jz scan_%d_next\n", i);
+		puts  ("    bsrl %eax, %eax");
+		puts  ("    leaq (%rsi,%rax), %r12");
+		printf("    jmp scan_%d_done\n", i);
+		printf("scan_%d_near:\n", i);
+		puts  ("    bsrl %eax, %eax");
+		puts  ("    subl %ecx, %eax");
+		puts  ("    leaq (%rsi,%rax), %r12");
+	}
+	printf("scan_%d_done:\n", i);
+}
+
+// With a profile in guide (-g), loops that never ran are moved out of
+// line into subsection 2, loops that always make a few trips have all
+// but the last peeled off, and scans that usually go far use SSE2.
+void compile(const struct ir_prog * const prog, const int pre,
+             const enum mode mode, const struct profile * const guide)
 {
-	int num_brackets = 0;
-	int matching_bracket = 0;
-	struct stack stack = { .size = 0, .items = { 0 } };
 	const char * const prologue =
 	    ".text\n"
 	    ".global main\n"
@@ -20,52 +317,167 @@ void compile(const char * const text_body)
 	    "    movq $30000, %rdx\n" // length 30,000 B
 	    "    call memset\n"       // memset
 	    "    movq %rsp, %r12";
-	puts(prologue);
+	if (mode == MODE_STANDALONE)
+		printf(".set IOBUF_SIZE, %d\n%s\n", IOBUF_SIZE,
+		       standalone_prologue);
+	else if (mode == MODE_LIBRARY)
+		puts(library_prologue);
+	else
+		puts(prologue);
 
-	for (unsigned long i = 0; text_body[i] != '\0'; ++i) {
-		switch (text_body[i]) {
-		case '>':
-			puts("    inc %r12");
-			break;
-		case '<':
-			puts("    dec %r12");
-			break;
-		case '+':
-			puts("    incb (%r12)");
-			break;
-		case '-':
-			puts("    decb (%r12)");
+	int resume = pre ? preeval(prog, mode) : -1;
+	// The subsection the loops are going into, and the close of the
+	// loop placed out of line, if any.
+	int text = 0, outlined = -1;
+	const struct profile_loop *l;
+	long trips;
+
+	for (int i = 0; i < prog->len; i++) {
+		const struct ir *op = &prog->ops[i];
+		if (i == resume)
+			puts("preeval_resume:");
+		switch (op->op) {
+		case IR_MOVE:
+		case IR_ADD:
+		case IR_SET:
+			compile_cell_op(op);
 			break;
-		case '.':
+		case IR_OUT:
+			// I/O is placed out of line in subsection 1, after
+			// all the hot code.  Standalone programs only move
+			// the flush there.
+			if (mode == MODE_STANDALONE) {
+				puts  ("    movb (%r12), %al");
+				puts  ("    movb %al, (%r13)");
+				puts  ("    incq %r13");
+				puts  ("    cmpq %rbx, %r13");
+				printf("    jae io_%d\n", i);
+				printf("io_%d_done:\n", i);
+				puts  (".text 1");
+				printf("io_%d:\n", i);
+				puts  ("    call bf_flush");
+				printf("    jmp io_%d_done\n", i);
+				printf(".text %d\n", text);
+				break;
+			}
+			printf("    jmp io_%d\n", i);
+			printf("io_%d_done:\n", i);
+			puts  (".text 1");
+			printf("io_%d:\n", i);
 			// move byte to double word and zero upper bits
 			// since putchar takes an int.
-			puts("    movzbl (%r12), %edi");
-			puts("    call putchar");
-			break;
-		case ',':
-			puts("    call getchar");
-			puts("    movb %al, (%r12)");
-			break;
-		case '[':
-			if (stack_push(&stack, num_brackets) == 0) {
-				puts  ("    cmpb $0, (%r12)");
-				printf("    je bracket_%d_end\n", num_brackets);
-				printf("bracket_%d_start:\n", num_brackets++);
+			puts  ("    movzbl (%r12), %edi");
+			if (mode == MODE_LIBRARY) {
+				puts("    movq 16(%r13), %rsi");
+				puts("    call *(%r13)");
 			} else {
-				err("out of stack space, too much nesting");
+				puts("    call putchar");
 			}
+			printf("    jmp io_%d_done\n", i);
+			printf(".text %d\n", text);
 			break;
-		case ']':
-			if (stack_pop(&stack, &matching_bracket) == 0) {
-				puts("    cmpb $0, (%r12)");
-				printf("    jne bracket_%d_start\n", matching_bracket);
-				printf("bracket_%d_end:\n", matching_bracket);
+		case IR_IN:
+			if (mode == MODE_STANDALONE) {
+				puts  ("    cmpq %r15, %r14");
+				printf("    jae io_%d\n", i);
+				printf("io_%d_load:\n", i);
+				puts  ("    movb (%r14), %al");
+				puts  ("    incq %r14");
+				puts  ("    movb %al, (%r12)");
+				printf("io_%d_done:\n", i);
+				puts  (".text 1");
+				// At end of input the cell becomes 255, as
+				// getchar()'s EOF does.
+				printf("io_%d:\n", i);
+				puts  ("    call bf_refill");
+				puts  ("    movb $-1, (%r12)");
+				puts  ("    cmpq %r15, %r14");
+				printf("    jb io_%d_load\n", i);
+				printf("    jmp io_%d_done\n", i);
+				printf(".text %d\n", text);
+				break;
+			}
+			printf("    jmp io_%d\n", i);
+			printf("io_%d_done:\n", i);
+			puts  (".text 1");
+			printf("io_%d:\n", i);
+			if (mode == MODE_LIBRARY) {
+				puts("    movq 16(%r13), %rdi");
+				puts("    call *8(%r13)");
 			} else {
-				err("stack underflow, unmatched brackets");
+				puts("    call getchar");
+			}
+			puts  ("    movb %al, (%r12)");
+			printf("    jmp io_%d_done\n", i);
+			printf(".text %d\n", text);
+			break;
+		case IR_OPEN:
+			l = profile_of(guide, op->bracket);
+			if (op->match == i + 2 && prog->ops[i + 1].op == IR_MOVE &&
+			    abs(prog->ops[i + 1].val) == 1 &&
+			    !(i < resume && resume <= op->match) &&
+			    profile_distance(l) >= SCAN_SIMD_MIN) {
+				compile_scan(i, prog->ops[i + 1].val);
+				i = op->match;
+				break;
+			}
+			if (outlined < 0 && profile_cold(l)) {
+				if (!op->val)
+					puts("    cmpb $0, (%r12)");
+				printf("    %s cold_%d\n", op->val ? "jmp" : "jne",
+				       i);
+				printf("cold_%d_done:\n", i);
+				puts  (".text 2");
+				printf("cold_%d:\n", i);
+				text = 2;
+				outlined = op->match;
+			} else if ((trips = profile_trips(l)) > 1 &&
+			           trips <= UNROLL_MAX && simple_body(prog, i)) {
+				// Peeled trips test at their end, like the
+				// loop they fall into for the last one.
+				if (!op->val) {
+					puts  ("    cmpb $0, (%r12)");
+					printf("    je bracket_%d_exit\n", i);
+				}
+				for (long t = 1; t < trips; t++) {
+					for (int k = i + 1; k < op->match; k++)
+						compile_cell_op(&prog->ops[k]);
+					puts  ("    cmpb $0, (%r12)");
+					printf("    je bracket_%d_exit\n", i);
+				}
+			} else if (!op->val) {
+				// Rotated loop: enter at the test on the
+				// bottom, so each iteration takes a single
+				// backward branch.
+				printf("    jmp bracket_%d_end\n", i);
+			}
+			puts  ("    .p2align 4");
+			printf("bracket_%d_start:\n", i);
+			break;
+		case IR_CLOSE:
+			printf("bracket_%d_end:\n", op->match);
+			puts("    cmpb $0, (%r12)");
+			printf("    jne bracket_%d_start\n", op->match);
+			printf("bracket_%d_exit:\n", op->match);
+			if (outlined == i) {
+				printf("    jmp cold_%d_done\n", op->match);
+				puts  (".text 0");
+				text = 0;
+				outlined = -1;
 			}
 			break;
 		}
 	}
+	if (resume == prog->len)
+		puts("preeval_resume:");
+	if (mode == MODE_STANDALONE) {
+		puts(standalone_epilogue);
+		return;
+	}
+	if (mode == MODE_LIBRARY) {
+		puts(library_epilogue);
+		return;
+	}
 	const char *const epilogue =
 	    "    addq $30008, %rsp\n" // clean up tape from stack.
 	    "    popq %r12\n" // restore callee saved register
@@ -76,9 +488,35 @@ void compile(const char * const text_body)
 
 int main(int argc, char *argv[])
 {
-	if (argc != 2) err("Usage: compiler-x64 <inputfile>");
-	char *text_body = read_file(argv[1]);
-	if (text_body == NULL) err("Unable to read file");
-	compile(text_body);
-	free(text_body);
+	const char * const usage =
+	    "Usage: compiler-x64 [-p] [-s | -l] [-g <profile>] <inputfile>";
+	int opt, pre = 0;
+	enum mode mode = MODE_LIBC;
+	const char *profile_file = NULL;
+	while ((opt = getopt(argc, argv, "g:lps")) != -1) {
+		if (opt == 'p') pre = 1;
+		else if (opt == 'g') profile_file = optarg;
+		else if (opt == 's' && mode == MODE_LIBC) mode = MODE_STANDALONE;
+		else if (opt == 'l' && mode == MODE_LIBC) mode = MODE_LIBRARY;
+		else err(usage);
+	}
+	if (optind != argc - 1) err(usage);
+	struct profile prof, *guide = NULL;
+	if (profile_file) {
+		char *source = read_file(argv[optind]);
+		if (source == NULL) err("Unable to read file");
+		profile_load(profile_file, hash_bytes(source, strlen(source)),
+		             &prof);
+		free(source);
+		guide = &prof;
+	}
+	FILE *fp = open_source(argv[optind]);
+	if (fp == NULL) err("Unable to read file");
+	struct ir_prog prog;
+	if (ir_parse(fp, &prog)) err("unmatched brackets");
+	fclose(fp);
+	ir_propagate(&prog);
+	compile(&prog, pre, mode, guide);
+	ir_free(&prog);
+	if (guide) profile_free(guide);
 }
@@ -1,12 +1,83 @@
 #include <stdio.h>
 #include <stdlib.h>
+#include <unistd.h>
 #include "util.h"
 
-void compile(const char * const text_body)
+// Size of each I/O buffer of the standalone runtime.
+#define IOBUF_SIZE 65536
+
+// Standalone programs (-s) link without the C library: they start at
+// _start, keep the tape in .bss, and buffer I/O themselves with raw
+// system calls.  %edi is the next free byte of the output buffer, and
+// %esi and %ebp bound the input not read yet.  Link with
+// gcc -m32 -nostdlib -static.
+static const char * const standalone_prologue =
+    ".section .text\n"
+    ".global _start\n"
+    "_start:\n"
+    "    movl $tape, %ecx\n"
+    "    movl $outbuf, %edi\n"
+    "    movl $inbuf, %esi\n"
+    "    movl %esi, %ebp";
+
+static const char * const standalone_epilogue =
+    "    call bf_flush\n"
+    "    movl $1, %eax\n"   // exit(0)
+    "    xorl %ebx, %ebx\n"
+    "    int $0x80\n"
+    "\n"
+    // Writes out the output buffer and empties it, dropping what
+    // cannot be written.
+    "bf_flush:\n"
+    "    pushl %ecx\n"
+    "    pushl %ebx\n"
+    "    movl $outbuf, %ecx\n"
+    "    movl %edi, %edx\n"
+    "    subl %ecx, %edx\n"
+    "1:  testl %edx, %edx\n"
+    "    jle 2f\n"
+    "    movl $4, %eax\n"   // write(1, %ecx, %edx)
+    "    movl $1, %ebx\n"
+    "    int $0x80\n"
+    "    testl %eax, %eax\n"
+    "    jle 2f\n"
+    "    addl %eax, %ecx\n"
+    "    subl %eax, %edx\n"
+    "    jmp 1b\n"
+    "2:  movl $outbuf, %edi\n"
+    "    popl %ebx\n"
+    "    popl %ecx\n"
+    "    ret\n"
+    "\n"
+    // Refills the input buffer, flushing the output first so prompts
+    // appear before the program waits.  Leaves it empty at end of input.
+    "bf_refill:\n"
+    "    call bf_flush\n"
+    "    pushl %ecx\n"
+    "    pushl %ebx\n"
+    "    movl $3, %eax\n"   // read(0, inbuf, IOBUF_SIZE)
+    "    xorl %ebx, %ebx\n"
+    "    movl $inbuf, %ecx\n"
+    "    movl $IOBUF_SIZE, %edx\n"
+    "    int $0x80\n"
+    "    movl $inbuf, %esi\n"
+    "    movl %esi, %ebp\n"
+    "    testl %eax, %eax\n"
+    "    jle 1f\n"
+    "    addl %eax, %ebp\n"
+    "1:  popl %ebx\n"
+    "    popl %ecx\n"
+    "    ret\n"
+    "\n"
+    ".lcomm tape, 30000\n"
+    ".lcomm outbuf, IOBUF_SIZE\n"
+    ".lcomm inbuf, IOBUF_SIZE\n";
+
+void compile(FILE * const fp, const int standalone)
 {
 	int num_brackets = 0;
 	int matching_brackets = 0;
-	struct stack stack = { .size = 0, .items = {0}};
+	struct stack stack = { .size = 0, .items = NULL };
 	const char * const prologue = 
 	    ".section .text\n"
 	    ".global main\n"
@@ -19,10 +90,14 @@ void compile(const char * const text_body)
 	    "    movl $3000, %edx\n"
 	    "    call memset\n"
 	    "    movl %esp, %ecx";
-	puts(prologue);
+	if (standalone)
+		printf(".set IOBUF_SIZE, %d\n%s\n", IOBUF_SIZE,
+		       standalone_prologue);
+	else
+		puts(prologue);
 
-	for (unsigned long i = 0; text_body[i] != '\0'; ++i) {
-		switch (text_body[i]){
+	for (int c; (c = getc(fp)) != EOF; ) {
+		switch (c) {
 		case '>':
 			puts("    inc %ecx");
 			break;
@@ -36,16 +111,41 @@ void compile(const char * const text_body)
 			puts("    decb (%ecx)");
 			break;
 		case '.':
+			if (standalone) {
+				puts("    movb (%ecx), %al");
+				puts("    movb %al, (%edi)");
+				puts("    incl %edi");
+				puts("    cmpl $outbuf+IOBUF_SIZE, %edi");
+				puts("    jb 1f");
+				puts("    call bf_flush");
+				puts("1:");
+				break;
+			}
 			puts("    call putchar");
 			break;
 		case ',':
+			if (standalone) {
+				// At end of input the cell becomes 255, as
+				// getchar()'s EOF does.
+				puts("    cmpl %ebp, %esi");
+				puts("    jb 1f");
+				puts("    call bf_refill");
+				puts("    movb $-1, (%ecx)");
+				puts("    cmpl %ebp, %esi");
+				puts("    jae 2f");
+				puts("1:  movb (%esi), %al");
+				puts("    incl %esi");
+				puts("    movb %al, (%ecx)");
+				puts("2:");
+				break;
+			}
 			puts("    call getchar");
 			puts("    movb %al, (%ecx)");
 			break;
 		case '[':
 			if (stack_push(&stack, num_brackets)==0) {
-				puts  ("    cmpb $0, (%ecx)");
-				printf("    je bracket_%d_end\n", num_brackets);
+				printf("    jmp bracket_%d_end\n", num_brackets);
+				puts  ("    .p2align 4");
 				printf("bracket_%d_start:\n", num_brackets++);
 			} else {
 				err("out of stack space");
@@ -53,15 +153,20 @@ void compile(const char * const text_body)
 			break;
 		case ']':
 			if (stack_pop(&stack, &matching_brackets)==0) {
-				puts  ("cmpb $0, (%ecx)");
-				printf("    jne bracket_%d_start\n", matching_brackets);
 				printf("bracket_%d_end:\n", matching_brackets);
+				puts  ("    cmpb $0, (%ecx)");
+				printf("    jne bracket_%d_start\n", matching_brackets);
 			} else {
 				err("stack underflow, unmatched");
 			}
 			break;
 		}
 	}
+	stack_free(&stack);
+	if (standalone) {
+		puts(standalone_epilogue);
+		return;
+	}
 	const char * const epilogue =
 	    "    addl $3008, %esp\n"
 	    "    popl %ebp\n"
@@ -76,9 +181,14 @@ void compile(const char * const text_body)
 
 int main(int argc, char *argv[])
 {
-	if (argc != 2) err("Usage: compile-x86 inputfile");
-	char *text_body = read_file(argv[1]);
-	if (text_body == NULL) err("unable to read file");
-	compile(text_body);
-	free(text_body);
+	int opt, standalone = 0;
+	while ((opt = getopt(argc, argv, "s")) != -1) {
+		if (opt == 's') standalone = 1;
+		else err("Usage: compile-x86 [-s] inputfile");
+	}
+	if (optind != argc - 1) err("Usage: compile-x86 [-s] inputfile");
+	FILE *fp = open_source(argv[optind]);
+	if (fp == NULL) err("unable to read file");
+	compile(fp, standalone);
+	fclose(fp);
 }
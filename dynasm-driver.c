@@ -1,8 +1,88 @@
 // Driver file for DynASM-based JITs.
 
+#define _GNU_SOURCE
 #include <assert.h>
+#include <pthread.h>
+#include <stdint.h>
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 #include <sys/mman.h>
+#include <unistd.h>
+
+// From util.h, which the JIT includes below.
+static inline void err(const char * const msg);
+
+// DynASM grows its buffers with realloc by default, which churns on
+// large programs.  Instead carve them out of a per-thread arena: the
+// buffer allocated last grows in place, and everything is released at
+// once when the state itself is freed.
+struct arena {
+	struct arena *next;
+	size_t size;
+	size_t used;
+	char *last; // most recent allocation, which may grow in place
+	char mem[];
+};
+
+static __thread struct arena *arena;
+
+static void *arena_grow(void *p, size_t old_size, size_t new_size)
+{
+	struct arena *a = arena;
+	new_size = (new_size + 15) & ~(size_t) 15;
+	if (p != NULL && a != NULL && p == a->last &&
+	    a->last + new_size <= a->mem + a->size) {
+		a->used = a->last - a->mem + new_size;
+		return p;
+	}
+	if (a == NULL || a->used + new_size > a->size) {
+		size_t size = a ? a->size * 2 : 1 << 16;
+		while (size < new_size) size *= 2;
+		struct arena *n = malloc(sizeof(*n) + size);
+		if (n == NULL) err("Out of memory");
+		n->next = a;
+		n->size = size;
+		n->used = 0;
+		arena = a = n;
+	}
+	char *q = a->mem + a->used;
+	a->used += new_size;
+	a->last = q;
+	if (p != NULL) memcpy(q, p, old_size);
+	return q;
+}
+
+static void arena_free(void)
+{
+	while (arena) {
+		struct arena *next = arena->next;
+		free(arena);
+		arena = next;
+	}
+}
+
+// Every DynASM buffer comes from the calling thread's arena, and freeing
+// a state releases the whole arena: a thread may have only one DynASM
+// state live at a time.  Compile on another thread to hold two.
+#define DASM_M_GROW(ctx, t, p, sz, need) \
+  do { \
+    size_t _sz = (sz), _need = (need); \
+    if (_sz < _need) { \
+      if (_sz < 16) _sz = 16; \
+      while (_sz < _need) _sz += _sz; \
+      (p) = (t *)arena_grow((p), (sz), _sz); \
+      (sz) = _sz; \
+    } \
+  } while(0)
+
+// The state is freed last, after the buffers hanging off it.
+#define DASM_M_FREE(ctx, p, sz) \
+  do { if ((void *)(p) == (void *)*(ctx)) arena_free(); } while (0)
+
+// Have DynASM check operands and labels as code is emitted; jitcode()
+// turns any error into a failed compile.
+#define DASM_CHECKS
 
 #include "dynasm/dasm_proto.h"
 
@@ -15,42 +95,246 @@
 #endif
 
 void initjit(dasm_State **state, const void *actionlist);
+// Links and encodes the code into executable memory.  The state is
+// left intact so pclabel offsets can be queried; release it with
+// dasm_free() afterwards.  Returns NULL if DynASM reports an error or
+// there is no memory for the code, so that one failed compile need not
+// end a server.
 void *jitcode(dasm_State **state);
 void free_jitcode(void *code);
+// Whether a section of state is close to the 2^24 action words DynASM
+// can address in one.  Emitting more would silently run into the next
+// section, so compilers check this between operations and give up.
+int jit_section_full(dasm_State **state);
+// Returns the number of bytes of code at code, a result of jitcode().
+size_t jitcode_size(const void *code);
+// Returns the operand for a direct `call &target` to addr, or NULL if
+// generated code is too far away and must call it indirectly.
+void *jit_rel_target(const void *addr);
+// Whether jitcode() writes each program's code to /tmp/jitcode (unless
+// NDEBUG).  Modes that compile on many threads at once turn it off, so
+// they don't race on the file or pay for the write.
+static int jitcode_dump = 1;
 
 #include JIT
 
 void initjit(dasm_State **state, const void *actionlist)
 {
+#ifdef DASM_MAXSECTION
+	dasm_init(state, DASM_MAXSECTION);
+#else
 	dasm_init(state, 1);
+#endif
+	// No global labels, but this also sets up the local ones.  DynASM
+	// keeps the array biased by -10, so hand it a pointer that stays
+	// inside an array after that; nothing is ever stored there.
+	static void *globals[10];
+	dasm_setupglobal(state, globals + 10, 0);
 	dasm_setup(state, actionlist);
 }
 
+// Room left in every section for the actions of one more operation.
+#define SECTION_SLACK (1 << 16)
+
+int jit_section_full(dasm_State **state)
+{
+	const dasm_State *D = *state;
+	for (int i = 0; i < D->maxsection; i++)
+		if (DASM_POS2IDX(D->sections[i].pos) >
+		    DASM_POS2IDX(-1) - SECTION_SLACK)
+			return 1;
+	return 0;
+}
+
+// Code heap.  Generated code lives in a memfd that is mapped twice: a
+// writable view the encoder writes through, and an executable view the
+// code runs from.  No page is ever writable and executable at once, and
+// no mprotect is needed per compilation.  Programs are sub-allocated from
+// a free list ordered by address, so freed neighbours coalesce.  The
+// memfd only takes memory for the pages code is written to, so the heap
+// is sized for the largest programs and long running servers at little
+// more than the cost of the address space.
+#define CODE_HEAP_SIZE ((size_t) 1 << 30)
+#define CODE_HEADER 16
+
+// Header in front of every block, written through the writable view.
+struct code_block {
+	size_t size; // including this header
+	struct code_block *next; // next free block, while on the free list
+};
+
+static struct {
+	char *rw;
+	char *rx;
+	struct code_block *free;
+	int state; // 0: not set up, 1: ready, -1: unavailable
+	pthread_mutex_t lock;
+} heap = { .lock = PTHREAD_MUTEX_INITIALIZER };
+
+static int code_heap_init(void)
+{
+	int fd = memfd_create("jitcode", MFD_CLOEXEC);
+	if (fd < 0) return -1;
+	if (ftruncate(fd, CODE_HEAP_SIZE) < 0) {
+		close(fd);
+		return -1;
+	}
+	// Ask for the executable view just below the C library, where
+	// the I/O functions generated code calls live, so they are in
+	// reach of a rel32 call.  The kernel may pick elsewhere.
+	uintptr_t hint = ((uintptr_t) &putc & ~(uintptr_t) 0xfff) -
+	                 ((uintptr_t) 1 << 30);
+	heap.rw = mmap(NULL, CODE_HEAP_SIZE, PROT_READ | PROT_WRITE,
+	               MAP_SHARED, fd, 0);
+	heap.rx = mmap((void *) hint, CODE_HEAP_SIZE, PROT_READ | PROT_EXEC,
+	               MAP_SHARED, fd, 0);
+	close(fd);
+	if (heap.rw == MAP_FAILED || heap.rx == MAP_FAILED) {
+		if (heap.rw != MAP_FAILED) munmap(heap.rw, CODE_HEAP_SIZE);
+		if (heap.rx != MAP_FAILED) munmap(heap.rx, CODE_HEAP_SIZE);
+		return -1;
+	}
+	heap.free = (struct code_block *) heap.rw;
+	heap.free->size = CODE_HEAP_SIZE;
+	heap.free->next = NULL;
+	return 0;
+}
+
+static int code_heap_ready(void)
+{
+	pthread_mutex_lock(&heap.lock);
+	if (heap.state == 0)
+		heap.state = code_heap_init() ? -1 : 1;
+	pthread_mutex_unlock(&heap.lock);
+	return heap.state > 0;
+}
+
+// Returns the writable address of a block with room for size bytes of
+// code, or NULL if the heap is unavailable or full.
+static char *code_heap_alloc(size_t size)
+{
+	char *rw = NULL;
+	size = (size + sizeof(struct code_block) + 15) & ~(size_t) 15;
+
+	if (!code_heap_ready()) return NULL;
+	pthread_mutex_lock(&heap.lock);
+	for (struct code_block **b = &heap.free; *b; b = &(*b)->next) {
+		if ((*b)->size < size) continue;
+		struct code_block *block = *b;
+		// Split off the tail unless it is too small to be useful.
+		if (block->size - size >= 2 * sizeof(struct code_block)) {
+			struct code_block *rest =
+			    (struct code_block *) ((char *) block + size);
+			rest->size = block->size - size;
+			rest->next = block->next;
+			block->size = size;
+			*b = rest;
+		} else {
+			*b = block->next;
+		}
+		rw = (char *) (block + 1);
+		break;
+	}
+	pthread_mutex_unlock(&heap.lock);
+	return rw;
+}
+
+static int code_heap_contains(const void *code)
+{
+	return heap.state > 0 && (const char *) code >= heap.rx &&
+	       (const char *) code < heap.rx + CODE_HEAP_SIZE;
+}
+
+static void code_heap_free(void *code)
+{
+	struct code_block *block = (struct code_block *)
+	    (heap.rw + ((char *) code - heap.rx)) - 1;
+
+	pthread_mutex_lock(&heap.lock);
+	struct code_block **b = &heap.free;
+	while (*b && *b < block)
+		b = &(*b)->next;
+	block->next = *b;
+	*b = block;
+	if (block->next &&
+	    (char *) block + block->size == (char *) block->next) {
+		block->size += block->next->size;
+		block->next = block->next->next;
+	}
+	// Merge into the previous free block, if adjacent.
+	for (struct code_block *prev = heap.free; prev != block;
+	     prev = prev->next) {
+		if (prev->next == block &&
+		    (char *) prev + prev->size == (char *) block) {
+			prev->size += block->size;
+			prev->next = block->next;
+			break;
+		}
+	}
+	pthread_mutex_unlock(&heap.lock);
+}
+
+void *jit_rel_target(const void *addr)
+{
+#if defined(__x86_64__)
+	if (!code_heap_ready()) return NULL;
+	// Every byte of the heap must be within +-2GB of addr.
+	const intptr_t reach = ((intptr_t) 1 << 31) - 16;
+	intptr_t lo = (intptr_t) addr - (intptr_t) heap.rx;
+	intptr_t hi = (intptr_t) addr - (intptr_t) (heap.rx + CODE_HEAP_SIZE);
+	if (lo >= reach || hi <= -reach) return NULL;
+	// DynASM encodes the displacement relative to where it writes
+	// the code, which is the writable view.
+	return (char *) addr - (heap.rx - heap.rw);
+#else
+	return NULL;
+#endif
+}
+
 void *jitcode(dasm_State **state)
 {
 	size_t size;
-	int dasm_status = dasm_link(state, &size);
-	assert(dasm_status == DASM_S_OK);
+	if (dasm_link(state, &size) != DASM_S_OK)
+		return NULL;
 
-	// Allocate memory readable and writable so we can
-	// write the encoded instructions there.
-	char *mem = mmap(NULL, size + sizeof(size_t),
-			PROT_READ | PROT_WRITE,
-			MAP_ANON | MAP_PRIVATE, -1, 0);
-	assert(mem != MAP_FAILED);
+	char *ret, *rw = code_heap_alloc(size);
+	// Code may already call through jit_rel_target(), which only
+	// holds inside the heap, so it cannot go anywhere else.
+	if (rw == NULL && heap.state > 0)
+		return NULL;
+	if (rw != NULL) {
+		ret = heap.rx + (rw - heap.rw);
+		if (dasm_encode(state, rw) != DASM_S_OK) {
+			code_heap_free(ret);
+			return NULL;
+		}
+		__builtin___clear_cache(ret, ret + size);
+	} else {
+		// No code heap: allocate memory readable and writable
+		// so we can write the encoded instructions there.
+		char *mem = mmap(NULL, size + CODE_HEADER,
+				PROT_READ | PROT_WRITE,
+				MAP_ANON | MAP_PRIVATE, -1, 0);
+		if (mem == MAP_FAILED) return NULL;
 
-	// Store length at the beginning of the region, so we
-	// can free it without additional context.
-	*(size_t *) mem = size;
-	void *ret = mem + sizeof(size_t);
+		// Store length at the beginning of the region, so we
+		// can free it without additional context.  The header
+		// keeps the code 16 byte aligned.
+		*(size_t *) mem = size;
+		rw = ret = mem + CODE_HEADER;
 
-	dasm_encode(state, ret);
-	dasm_free(state);
+		if (dasm_encode(state, ret) != DASM_S_OK) {
+			munmap(mem, size + CODE_HEADER);
+			return NULL;
+		}
 
-	// Adjust the memory permissions so it is executable
-	// but no longer writable.
-	int success = mprotect(mem, size, PROT_EXEC | PROT_READ);
-	assert(success == 0);
+		// Adjust the memory permissions so it is executable
+		// but no longer writable.
+		int success = mprotect(mem, size + CODE_HEADER,
+		                       PROT_EXEC | PROT_READ);
+		assert(success == 0);
+		__builtin___clear_cache(ret, ret + size);
+	}
 
 #ifndef NDEBUG
 	// Write generated machine code to a temporary file.
@@ -58,9 +342,11 @@ void *jitcode(dasm_State **state)
 	//  objdump -D -b binary -mi386 -Mx86-64 /tmp/jitcode
 	// Or: (arm)
 	//  arm-linux-gnueabihf-objdump -D -b binary -marm /tmp/jitcode
-	FILE *f = fopen("/tmp/jitcode", "wb");
-	fwrite(ret, size, 1, f);
-	fclose(f);
+	FILE *f = jitcode_dump ? fopen("/tmp/jitcode", "wb") : NULL;
+	if (f) {
+		fwrite(rw, size, 1, f);
+		fclose(f);
+	}
 #endif
 
 	return ret;
@@ -68,7 +354,19 @@ void *jitcode(dasm_State **state)
 
 void free_jitcode(void *code)
 {
-	void *mem = (char *) code - sizeof(size_t);
-	int status = munmap(mem, *(size_t *) mem);
+	if (code_heap_contains(code)) {
+		code_heap_free(code);
+		return;
+	}
+	void *mem = (char *) code - CODE_HEADER;
+	int status = munmap(mem, *(size_t *) mem + CODE_HEADER);
 	assert(status == 0);
 }
+
+size_t jitcode_size(const void *code)
+{
+	const char *mem = (const char *) code - CODE_HEADER;
+	if (code_heap_contains(code))
+		return ((const struct code_block *) mem)->size - CODE_HEADER;
+	return *(const size_t *) mem;
+}
@@ -0,0 +1,135 @@
+.section .text
+.global main
+main:
+    pushl %ebp
+    movl  %esp, %ebp
+    addl  $-3008, %esp
+    leal  (%esp), %edi
+    movl $0, %esi
+    movl $3000, %edx
+    call memset
+    movl %esp, %ecx
+    incb (%ecx)
+    incb (%ecx)
+    incb (%ecx)
+    incb (%ecx)
+    incb (%ecx)
+    incb (%ecx)
+    incb (%ecx)
+    incb (%ecx)
+    incb (%ecx)
+    incb (%ecx)
+    jmp bracket_0_end
+    .p2align 4
+bracket_0_start:
+    inc %ecx
+    incb (%ecx)
+    incb (%ecx)
+    incb (%ecx)
+    incb (%ecx)
+    incb (%ecx)
+    incb (%ecx)
+    incb (%ecx)
+    inc %ecx
+    incb (%ecx)
+    incb (%ecx)
+    incb (%ecx)
+    incb (%ecx)
+    incb (%ecx)
+    incb (%ecx)
+    incb (%ecx)
+    incb (%ecx)
+    incb (%ecx)
+    incb (%ecx)
+    inc %ecx
+    incb (%ecx)
+    incb (%ecx)
+    incb (%ecx)
+    inc %ecx
+    incb (%ecx)
+    dec %ecx
+    dec %ecx
+    dec %ecx
+    dec %ecx
+    decb (%ecx)
+bracket_0_end:
+    cmpb $0, (%ecx)
+    jne bracket_0_start
+    inc %ecx
+    incb (%ecx)
+    incb (%ecx)
+    call putchar
+    inc %ecx
+    incb (%ecx)
+    call putchar
+    incb (%ecx)
+    incb (%ecx)
+    incb (%ecx)
+    incb (%ecx)
+    incb (%ecx)
+    incb (%ecx)
+    incb (%ecx)
+    call putchar
+    call putchar
+    incb (%ecx)
+    incb (%ecx)
+    incb (%ecx)
+    call putchar
+    inc %ecx
+    incb (%ecx)
+    incb (%ecx)
+    call putchar
+    dec %ecx
+    dec %ecx
+    incb (%ecx)
+    incb (%ecx)
+    incb (%ecx)
+    incb (%ecx)
+    incb (%ecx)
+    incb (%ecx)
+    incb (%ecx)
+    incb (%ecx)
+    incb (%ecx)
+    incb (%ecx)
+    incb (%ecx)
+    incb (%ecx)
+    incb (%ecx)
+    incb (%ecx)
+    incb (%ecx)
+    call putchar
+    inc %ecx
+    call putchar
+    incb (%ecx)
+    incb (%ecx)
+    incb (%ecx)
+    call putchar
+    decb (%ecx)
+    decb (%ecx)
+    decb (%ecx)
+    decb (%ecx)
+    decb (%ecx)
+    decb (%ecx)
+    call putchar
+    decb (%ecx)
+    decb (%ecx)
+    decb (%ecx)
+    decb (%ecx)
+    decb (%ecx)
+    decb (%ecx)
+    decb (%ecx)
+    decb (%ecx)
+    call putchar
+    inc %ecx
+    incb (%ecx)
+    call putchar
+    inc %ecx
+    call putchar
+    addl $3008, %esp
+    popl %ebp
+    ret
+putchar:
+    mov $4, %eax
+    mov $1, %ebx
+    mov $1, %edx
+    int $0x80
+
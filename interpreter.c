@@ -1,18 +1,45 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdint.h>
+#include <string.h>
+#include <unistd.h>
 #include "util.h"
+#include "checkpoint.h"
+#include "profile.h"
 
-void interpret(const char *const input)
+// Numbers the loops of input: for each '[' and ']', the ordinal of the
+// '[' of their loop.  Returns the number of loops.
+static int number_loops(const char *const input, int *const loop_of)
 {
-	// Initialize the tape with 30,000 zeroes.
-	uint8_t tape[30000] = { 0 };
+	struct stack open = { .size = 0, .items = NULL };
+	int loops = 0;
+	for (int i = 0; input[i] != '\0'; i++) {
+		if (input[i] == '[') {
+			loop_of[i] = loops++;
+			if (stack_push(&open, loop_of[i])) err("Out of memory");
+		} else if (input[i] == ']' && stack_pop(&open, &loop_of[i])) {
+			loop_of[i] = -1;
+		}
+	}
+	stack_free(&open);
+	return loops;
+}
 
-	// Set the pointer to point at the left most cell of the tape.
-	uint8_t *ptr = tape;
+// Runs input from the state in c.  If checkpoint_file is set, saves the
+// state there at a back-edge when a checkpoint is requested (the pc saved
+// is the index of the ']' about to jump back).  If prof is set, records
+// each loop's trips into it; loop_of numbers the loops.
+void interpret(const char *const input, struct checkpoint *const c,
+               const char *const checkpoint_file,
+               struct profile *const prof, const int *const loop_of)
+{
+	uint8_t *const tape = c->tape;
+	uint8_t *ptr = tape + c->ptr;
+	// Trips so far of the loops being run, innermost on top.
+	struct stack trips = { .size = 0, .items = NULL };
 
 	char current_char;
-	for (int i = 0; (current_char = input[i]) != '\0'; ++i) {
+	for (int i = c->pc; (current_char = input[i]) != '\0'; ++i) {
 		switch (current_char) {
 		case '>':
 			++ptr;
@@ -28,11 +55,18 @@ void interpret(const char *const input)
 			break;
 		case '.':
 			putchar(*ptr);
+			c->out++;
 			break;
 		case ',':
 			*ptr = getchar();
+			c->in++;
 			break;
 		case '[':
+			if (prof && !*ptr) {
+				profile_record(&prof->loop[loop_of[i]], 0);
+			} else if (prof && stack_push(&trips, 1)) {
+				err("Out of memory");
+			}
 			if (!(*ptr)) {
 				int loop = 1;
 				while (loop > 0) {
@@ -45,7 +79,26 @@ void interpret(const char *const input)
 			}
 			break;
 		case ']':
+			// Loops entered before resuming a checkpoint are not
+			// on the stack, and go unrecorded.
+			if (prof && trips.size && loop_of[i] >= 0) {
+				int n;
+				if (*ptr)
+					trips.items[trips.size - 1]++;
+				else if (!stack_pop(&trips, &n))
+					profile_record(&prof->loop[loop_of[i]], n);
+			}
 			if (*ptr) {
+				if (checkpoint_requested && checkpoint_file) {
+					const int stop = checkpoint_requested
+					               == CHECKPOINT_STOP;
+					checkpoint_requested = CHECKPOINT_NONE;
+					fflush(stdout);
+					c->pc = i;
+					c->ptr = ptr - tape;
+					checkpoint_save(checkpoint_file, c);
+					if (stop) exit(CHECKPOINT_EXIT);
+				}
 				int loop = 1;
 				while (loop > 0) {
 					current_char = input[--i];
@@ -58,13 +111,53 @@ void interpret(const char *const input)
 			break;
 		}
 	}
+	stack_free(&trips);
 }
 
 int main(int argc, char *argv[])
 {
-	if (argc != 2) err("Usage: interpreter <inputfile>");
-	char *file_contents = read_file(argv[1]);
+	const char *checkpoint_file = NULL, *resume_file = NULL;
+	const char *profile_file = NULL;
+	int opt;
+	while ((opt = getopt(argc, argv, "c:p:r:")) != -1) {
+		switch (opt) {
+		case 'c': checkpoint_file = optarg; break;
+		case 'p': profile_file = optarg; break;
+		case 'r': resume_file = optarg; break;
+		default: optind = argc; break;
+		}
+	}
+	if (optind != argc - 1)
+		err("Usage: interpreter [-c <checkpoint>] [-r <checkpoint>] "
+		    "[-p <profile>] <inputfile>");
+	char *file_contents = read_file(argv[optind]);
 	if (file_contents == NULL) err("Couldn't open file");
-	interpret(file_contents);
+
+	static struct checkpoint state = { .tool = "interpreter" };
+	state.program = hash_bytes(file_contents, strlen(file_contents));
+	if (resume_file) {
+		checkpoint_load(resume_file, state.tool, state.program, &state);
+		if (state.pc < 0 || state.pc >= (long) strlen(file_contents) ||
+		    file_contents[state.pc] != ']')
+			err("Corrupt checkpoint");
+		checkpoint_resume_io(&state);
+	}
+	if (checkpoint_file) checkpoint_signals();
+
+	struct profile prof;
+	int *loop_of = NULL;
+	if (profile_file) {
+		loop_of = calloc(strlen(file_contents) + 1, sizeof(int));
+		if (loop_of == NULL) err("Out of memory");
+		profile_init(&prof, state.program,
+		             number_loops(file_contents, loop_of));
+	}
+	interpret(file_contents, &state, checkpoint_file,
+	          profile_file ? &prof : NULL, loop_of);
+	if (profile_file) {
+		profile_save(profile_file, &prof);
+		profile_free(&prof);
+		free(loop_of);
+	}
 	free(file_contents);
 }
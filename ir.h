@@ -0,0 +1,391 @@
+// Intermediate representation shared by the optimizing backends.
+//
+// The source is folded into a flat array of operations: runs of +/- and
+// </> collapse into a single IR_ADD or IR_MOVE, and clear loops such as
+// [-] become IR_SET.  Loops keep the index of their partner so passes and
+// code generators can jump over them without a stack.
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include "util.h"
+
+enum ir_op {
+	IR_ADD,   // *ptr += val
+	IR_MOVE,  // ptr += val
+	IR_SET,   // *ptr = val
+	IR_OUT,   // putchar(*ptr)
+	IR_IN,    // *ptr = getchar()
+	IR_OPEN,  // while (*ptr) {  val != 0: *ptr is known nonzero on entry
+	IR_CLOSE, // }
+};
+
+struct ir {
+	enum ir_op op;
+	int val;
+	int match;   // index of the partner IR_OPEN/IR_CLOSE
+	int bracket; // IR_OPEN: ordinal of its '[' in the source
+};
+
+struct ir_prog {
+	struct ir *ops;
+	int len;
+	int cap;
+};
+
+static inline
+int ir_emit(struct ir_prog * const prog, const enum ir_op op, const int val)
+{
+	if (prog->len == prog->cap) {
+		prog->cap = prog->cap ? prog->cap * 2 : 256;
+		prog->ops = realloc(prog->ops, prog->cap * sizeof(struct ir));
+		if (prog->ops == NULL) err("Out of memory.");
+	}
+	prog->ops[prog->len] = (struct ir) { .op = op, .val = val };
+	return prog->len++;
+}
+
+static inline
+void ir_free(struct ir_prog * const prog)
+{
+	free(prog->ops);
+	prog->ops = NULL;
+	prog->len = prog->cap = 0;
+}
+
+// Appends an ADD or MOVE, merging it into the previous operation of the
+// same kind.  Operations that cancel out are dropped altogether.
+static inline
+void ir_emit_run(struct ir_prog * const prog, const enum ir_op op, int val)
+{
+	struct ir *last = prog->len ? &prog->ops[prog->len - 1] : NULL;
+	if (last && last->op == op) {
+		val += last->val;
+		prog->len--;
+	}
+	if (op == IR_ADD)
+		val &= 0xff;
+	if (val)
+		ir_emit(prog, op, val);
+}
+
+// Translates brainfuck source streamed from fp into IR, so only the
+// folded program is held in memory.  Returns 0 on success and -1 on
+// unbalanced brackets.
+static inline
+int ir_parse(FILE * const fp, struct ir_prog * const prog)
+{
+	struct stack stack = { .size = 0, .items = NULL };
+	int open, brackets = 0;
+
+	memset(prog, 0, sizeof(*prog));
+	for (int c; (c = getc(fp)) != EOF; ) {
+		switch (c) {
+		case '+': ir_emit_run(prog, IR_ADD, 1); break;
+		case '-': ir_emit_run(prog, IR_ADD, -1); break;
+		case '>': ir_emit_run(prog, IR_MOVE, 1); break;
+		case '<': ir_emit_run(prog, IR_MOVE, -1); break;
+		case '.': ir_emit(prog, IR_OUT, 0); break;
+		case ',': ir_emit(prog, IR_IN, 0); break;
+		case '[':
+			open = ir_emit(prog, IR_OPEN, 0);
+			prog->ops[open].bracket = brackets++;
+			if (stack_push(&stack, open)) err("Out of memory.");
+			break;
+		case ']': {
+			if (stack_pop(&stack, &open)) {
+				stack_free(&stack);
+				return -1;
+			}
+			// An odd step wraps around to zero on every value,
+			// so [-], [+], [---] and friends just clear the cell.
+			if (prog->len == open + 2 &&
+			    prog->ops[open + 1].op == IR_ADD &&
+			    (prog->ops[open + 1].val & 1)) {
+				prog->len = open;
+				ir_emit(prog, IR_SET, 0);
+				break;
+			}
+			int close = ir_emit(prog, IR_CLOSE, 0);
+			prog->ops[open].match = close;
+			prog->ops[close].match = open;
+			break;
+		}
+		}
+	}
+	int unbalanced = stack.size;
+	stack_free(&stack);
+	return unbalanced ? -1 : 0;
+}
+
+// Constant propagation.
+//
+// Cell values are tracked in a window around the pointer.  At program
+// start every cell is known to be zero, after a loop its cell is zero, and
+// a balanced loop (one that always returns the pointer to where it
+// started) only clobbers the cells it writes.  With that knowledge:
+//   - loops entered on a known zero cell are dead and removed,
+//   - additions to a known cell become a single store, folding [-]+++
+//     into one IR_SET,
+//   - stores of a value the cell already holds are dropped,
+//   - loops entered on a known nonzero cell skip their entry test.
+
+#define IR_WINDOW 512
+#define IR_UNKNOWN (-1)
+// Loops longer than this are not scanned for the cells they write, which
+// keeps deeply nested programs from taking quadratic time.
+#define IR_SCAN_LIMIT 4096
+
+struct ir_known {
+	int pos;                 // pointer position inside the window
+	short val[IR_WINDOW];    // cell values, or IR_UNKNOWN
+};
+
+static inline
+void ir_known_forget(struct ir_known * const k)
+{
+	k->pos = IR_WINDOW / 2;
+	for (int i = 0; i < IR_WINDOW; i++)
+		k->val[i] = IR_UNKNOWN;
+}
+
+// Marks every cell the loop at ops[open] may write as unknown in k.
+// Returns -1 if the loop is not balanced, strays outside the window or
+// is too long to scan, in which case nothing can be said about any cell.
+static inline
+int ir_loop_clobber(const struct ir_prog * const prog, const int open,
+                    struct ir_known * const k)
+{
+	struct stack base = { .size = 0, .items = NULL };
+	int pos = k->pos, start = 0, status = 0;
+
+	if (prog->ops[open].match - open > IR_SCAN_LIMIT) return -1;
+	for (int i = open; i <= prog->ops[open].match && !status; i++) {
+		const struct ir *op = &prog->ops[i];
+		switch (op->op) {
+		case IR_MOVE:
+			pos += op->val;
+			if (pos < 0 || pos >= IR_WINDOW) status = -1;
+			break;
+		case IR_ADD:
+		case IR_SET:
+		case IR_IN:
+			k->val[pos] = IR_UNKNOWN;
+			break;
+		case IR_OPEN:
+			if (stack_push(&base, pos)) err("Out of memory.");
+			break;
+		case IR_CLOSE:
+			stack_pop(&base, &start);
+			if (pos != start) status = -1;
+			break;
+		case IR_OUT:
+			break;
+		}
+	}
+	stack_free(&base);
+	return status;
+}
+
+static inline
+void ir_propagate(struct ir_prog * const prog)
+{
+	struct ir_prog out = { 0 };
+	struct ir_known k;
+	// Loops being emitted: their OPEN in out, and for balanced loops
+	// the knowledge that holds after the loop ends.
+	struct loop {
+		int open;
+		struct ir_known *exit;
+	} *stack = NULL;
+	int depth = 0, cap = 0;
+
+	// The tape starts out zeroed with the pointer on its first cell.
+	k.pos = 0;
+	memset(k.val, 0, sizeof(k.val));
+
+	for (int i = 0; i < prog->len; i++) {
+		const struct ir *op = &prog->ops[i];
+		short *cell = &k.val[k.pos];
+		switch (op->op) {
+		case IR_MOVE:
+			k.pos += op->val;
+			if (k.pos < 0 || k.pos >= IR_WINDOW)
+				ir_known_forget(&k);
+			ir_emit_run(&out, IR_MOVE, op->val);
+			break;
+		case IR_ADD:
+			if (*cell == IR_UNKNOWN) {
+				ir_emit_run(&out, IR_ADD, op->val);
+				break;
+			}
+			*cell = (*cell + op->val) & 0xff;
+			// Fold into a store, replacing the one just emitted.
+			if (out.len && out.ops[out.len - 1].op == IR_SET)
+				out.len--;
+			ir_emit(&out, IR_SET, *cell);
+			break;
+		case IR_SET:
+			if (*cell == op->val) break;
+			*cell = op->val;
+			if (out.len && out.ops[out.len - 1].op == IR_SET)
+				out.len--;
+			ir_emit(&out, IR_SET, op->val);
+			break;
+		case IR_IN:
+			*cell = IR_UNKNOWN;
+			ir_emit(&out, IR_IN, 0);
+			break;
+		case IR_OUT:
+			ir_emit(&out, IR_OUT, 0);
+			break;
+		case IR_OPEN: {
+			if (*cell == 0) {
+				i = op->match;
+				break;
+			}
+			if (depth == cap) {
+				cap = cap ? cap * 2 : 64;
+				stack = realloc(stack, cap * sizeof(*stack));
+				if (stack == NULL) err("Out of memory.");
+			}
+			int nonzero = *cell != IR_UNKNOWN;
+			struct ir_known *exit = malloc(sizeof(*exit));
+			if (exit == NULL) err("Out of memory.");
+			*exit = k;
+			if (ir_loop_clobber(prog, i, exit) < 0) {
+				free(exit);
+				exit = NULL;
+				ir_known_forget(&k);
+			} else {
+				k = *exit;
+			}
+			stack[depth].open = ir_emit(&out, IR_OPEN, nonzero);
+			out.ops[stack[depth].open].bracket = op->bracket;
+			stack[depth++].exit = exit;
+			break;
+		}
+		case IR_CLOSE: {
+			depth--;
+			int open = stack[depth].open;
+			int close = ir_emit(&out, IR_CLOSE, 0);
+			out.ops[open].match = close;
+			out.ops[close].match = open;
+			if (stack[depth].exit) {
+				k = *stack[depth].exit;
+				free(stack[depth].exit);
+			} else {
+				ir_known_forget(&k);
+			}
+			k.val[k.pos] = 0;
+			break;
+		}
+		}
+	}
+	free(stack);
+	ir_free(prog);
+	*prog = out;
+}
+
+// Multiply loops.
+//
+// An innermost loop made only of IR_ADD and IR_MOVE, that returns the
+// pointer to where it started and steps its own cell by an odd amount,
+// runs a number of times fixed on entry: [->+>++<<] runs *ptr times,
+// adding *ptr to the next cell and twice that to the one after.  Any odd
+// step reaches zero, as it is invertible modulo 256.  Such a loop is
+// equivalent to ptr[off] += *ptr * factor for each cell it touches,
+// followed by *ptr = 0, with no loop at all.
+
+struct ir_mul {
+	int off;    // offset from the loop's cell, never 0
+	int factor; // multiplier of the loop's cell, 0 to 255
+};
+
+// Recognizes the loop at ops[open] as a multiply loop, storing up to max
+// terms into terms in the order their cells are first touched.  Returns
+// the number of terms, or -1 if it is not a multiply loop or needs more
+// than max terms.
+static inline
+int ir_mul_loop(const struct ir_prog * const prog, const int open,
+                struct ir_mul * const terms, const int max)
+{
+	int pos = 0, step = 0, n = 0;
+
+	for (int i = open + 1; i < prog->ops[open].match; i++) {
+		const struct ir *op = &prog->ops[i];
+		if (op->op == IR_MOVE) {
+			pos += op->val;
+			continue;
+		}
+		if (op->op != IR_ADD) return -1;
+		if (pos == 0) {
+			step += op->val;
+			continue;
+		}
+		int k = 0;
+		while (k < n && terms[k].off != pos)
+			k++;
+		if (k == n) {
+			if (n == max) return -1;
+			terms[n++] = (struct ir_mul) { .off = pos, .factor = 0 };
+		}
+		terms[k].factor += op->val;
+	}
+	step &= 0xff;
+	if (pos != 0 || !(step & 1)) return -1;
+
+	// The loop runs -*ptr / step times modulo 256.  An odd step is its
+	// own inverse modulo 8, and each Newton round doubles the bits.
+	int inv = step;
+	for (int r = 0; r < 2; r++)
+		inv = inv * (2 - step * inv) & 0xff;
+	for (int k = 0; k < n; k++)
+		terms[k].factor = -terms[k].factor * inv & 0xff;
+	return n;
+}
+
+// Interprets prog starting at op index pc, with *ptr pointing into a tape
+// of tape_size cells starting at tape.  Stops at the end of the program,
+// before an IR_IN when in is NULL, before the pointer would leave the
+// tape, or once *steps operations have run.  Returns the index of the
+// next operation to execute and leaves *ptr and *steps updated.
+static inline
+int ir_eval(const struct ir_prog * const prog, int pc,
+            uint8_t * const tape, const int tape_size, uint8_t **ptr,
+            FILE * const in, FILE * const out, long * const steps)
+{
+	uint8_t *p = *ptr;
+	for (; pc < prog->len && *steps > 0; pc++, --*steps) {
+		const struct ir *op = &prog->ops[pc];
+		switch (op->op) {
+		case IR_ADD:
+			*p += op->val;
+			break;
+		case IR_MOVE:
+			if (p + op->val < tape || p + op->val >= tape + tape_size)
+				goto stop;
+			p += op->val;
+			break;
+		case IR_SET:
+			*p = op->val;
+			break;
+		case IR_OUT:
+			putc(*p, out);
+			break;
+		case IR_IN:
+			if (in == NULL) goto stop;
+			*p = getc(in);
+			break;
+		case IR_OPEN:
+			if (!*p) pc = op->match;
+			break;
+		case IR_CLOSE:
+			if (*p) pc = op->match;
+			break;
+		}
+	}
+stop:
+	*ptr = p;
+	return pc;
+}
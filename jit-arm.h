@@ -0,0 +1,972 @@
+/*
+** This file has been pre-processed with DynASM.
+** http://luajit.org/dynasm.html
+** DynASM version 1.3.0, DynASM arm version 1.3.0
+** DO NOT EDIT! The original file is in "jit-arm.dasc".
+*/
+
+#line 1 "jit-arm.dasc"
+#include <stdint.h>
+#include <stdlib.h>
+#include <sys/auxv.h>
+#include <unistd.h>
+#include "ir.h"
+
+#ifndef HWCAP_ARM_NEON
+#define HWCAP_ARM_NEON (1 << 12)
+#endif
+
+//|.arch arm
+#if DASM_VERSION != 10300
+#error "Version mismatch between DynASM and included encoding engine"
+#endif
+#line 12 "jit-arm.dasc"
+//|.actionlist actions
+static const unsigned int actions[261] = {
+0xe92d4ff0,
+0xe1a04000,
+0xe1a0a001,
+0xe1a06001,
+0xe281b000,
+0x000a0000,
+0xe1a0800b,
+0xe1a0900b,
+0x00000000,
+0xf2802e50,
+0x00000000,
+0xe5445000,
+0x000d8180,
+0x00000000,
+0xe2844000,
+0x000a0000,
+0x00000000,
+0xe2444000,
+0x000a0000,
+0x00000000,
+0xe5445000,
+0x000d8180,
+0x00000000,
+0xe5545000,
+0x000d8180,
+0x00000000,
+0xe2855000,
+0x000a0000,
+0x00000000,
+0xe5445000,
+0x000d8180,
+0x00000000,
+0xe2844000,
+0x000a0000,
+0x00000000,
+0xe2444000,
+0x000a0000,
+0x00000000,
+0xe5445000,
+0x000d8180,
+0x00000000,
+0xe1a00004,
+0x00000000,
+0xe2440000,
+0x000a0000,
+0x00000000,
+0xf4002a0d,
+0x00000000,
+0xf400270d,
+0x00000000,
+0xe3a01000,
+0x00000000,
+0xe4c01001,
+0x00000000,
+0xe5445000,
+0x000d8180,
+0x00000000,
+0xe3a05000,
+0x000a0000,
+0x00000000,
+0xe5445000,
+0x000d8180,
+0x00000000,
+0xe5545000,
+0x000d8180,
+0x00000000,
+0xeb000000,
+0x00070000,
+0x00000000,
+0xe4c65001,
+0xe156000b,
+0x0b000000,
+0x00070000,
+0x00000000,
+0xe5445000,
+0x000d8180,
+0x00000000,
+0xe5545000,
+0x000d8180,
+0x00000000,
+0xeb000000,
+0x00070000,
+0x00000000,
+0xe1580009,
+0x0b000000,
+0x00070000,
+0xe1580009,
+0x14d85001,
+0x00000000,
+0xe5445000,
+0x000d8180,
+0x00000000,
+0xe2844000,
+0x000a0000,
+0x00000000,
+0xe2444000,
+0x000a0000,
+0x00000000,
+0xe5445000,
+0x000d8180,
+0x00000000,
+0xeb000000,
+0x00070000,
+0x00000000,
+0xe5d45000,
+0xe3550000,
+0x0a000000,
+0x00050002,
+0x00000000,
+0x0006000b,
+0xe5745000,
+0x000d8180,
+0xe3550000,
+0x1a000000,
+0x0005000b,
+0x0006000c,
+0x00000000,
+0xea000000,
+0x00070000,
+0x00000000,
+0x0004000f,
+0x00000000,
+0x00080000,
+0x00000000,
+0xe5445000,
+0x000d8180,
+0x00000000,
+0xe2844000,
+0x000a0000,
+0x00000000,
+0xe2444000,
+0x000a0000,
+0x00000000,
+0xe5445000,
+0x000d8180,
+0x00000000,
+0xe31500ff,
+0x1a000000,
+0x00070000,
+0x00000000,
+0xea000000,
+0x00050001,
+0x00000000,
+0xe5445000,
+0x000d8180,
+0x00000000,
+0x00080000,
+0xe5d45000,
+0xe3550000,
+0x1a000000,
+0x00070000,
+0x00000000,
+0x0006000b,
+0x00000000,
+0xeb000000,
+0x00070000,
+0xe8bd8ff0,
+0x00000000,
+0x00080000,
+0x0006000b,
+0x00000000,
+0xe2440000,
+0x000a0000,
+0x00000000,
+0xf4240a0f,
+0x00000000,
+0xf4200a0f,
+0x00000000,
+0xf424080f,
+0x00000000,
+0xf420080f,
+0x00000000,
+0xf424000f,
+0x00000000,
+0xf420000f,
+0x00000000,
+0xf3b10140,
+0xf3004a01,
+0xec510b14,
+0x00000000,
+0xf3b10100,
+0xec510b10,
+0x00000000,
+0xe1900001,
+0x00000000,
+0x02844000,
+0x000a0000,
+0x00000000,
+0x02444000,
+0x000a0000,
+0x00000000,
+0x0a000000,
+0x0005000b,
+0x0006000c,
+0xe5d45000,
+0xe3550000,
+0x012fff1e,
+0x00000000,
+0xe2844000,
+0x000a0000,
+0x00000000,
+0xe2444000,
+0x000a0000,
+0x00000000,
+0xea000000,
+0x0005000c,
+0x00000000,
+0x00080000,
+0xe4c65001,
+0xe156000b,
+0x112fff1e,
+0xea000000,
+0x00070000,
+0x00000000,
+0x00080000,
+0xe1580009,
+0x14d85001,
+0x112fff1e,
+0xe92d4001,
+0xeb000000,
+0x00070000,
+0xe8bd4001,
+0xe1580009,
+0x14d85001,
+0xe12fff1e,
+0x00000000,
+0x00080000,
+0xe1a0100a,
+0x0006000b,
+0xe0562001,
+0x0a000000,
+0x00050002,
+0xe3a00001,
+0xe3a07004,
+0xef000000,
+0xe3500000,
+0xda000000,
+0x00050002,
+0xe0811000,
+0xea000000,
+0x0005000b,
+0x0006000c,
+0xe1a0600a,
+0xe12fff1e,
+0x00000000,
+0x00080000,
+0xe92d4001,
+0xeb000000,
+0x00070000,
+0xe3a00000,
+0xe1a0100b,
+0xe3a02000,
+0x000a0000,
+0xe3a07003,
+0xef000000,
+0xe1a0800b,
+0xe3500000,
+0xc0889000,
+0xd1a09008,
+0xe8bd8001,
+0x00000000
+};
+
+#line 13 "jit-arm.dasc"
+//|
+//|// Use r4 as our cell pointer.
+//|// Since r4 is a callee-save register, it will be preserved
+//|// across our calls to getchar and putchar.
+//|.define PTR, r4
+//|// I/O goes through buffers placed after the tape, IOBUF_SIZE bytes
+//|// of output followed by as much input.  OUTP is the next free byte of
+//|// output and OUTEND the end of the output buffer; INP and INEND bound
+//|// the input not read yet.  IOBUF is the start of both buffers.
+//|.define OUTP, r6
+//|.define INP, r8
+//|.define INEND, r9
+//|.define IOBUF, r10
+//|.define OUTEND, r11
+//|
+//|// Between loop boundaries the pointer stays put: moves fold into the
+//|// offset pos, and cells are addressed as [PTR, #pos].  r5 caches the
+//|// cell at offset cell (NO_CELL if none), which is written back once
+//|// another cell is needed, or at the next loop boundary.
+//|.macro store_cell
+//||if (dirty) {
+//|  strb  r5, [PTR, #cell]
+//||	dirty = 0;
+//||}
+//|.endmacro
+//|
+//|.macro load_cell
+//||if (cell != pos) {
+//|  store_cell
+//|  ldrb  r5, [PTR, #pos]
+//||	cell = pos;
+//||}
+//|.endmacro
+//|
+//|// Moves PTR to the current cell, in steps that fit an immediate.
+//|.macro sync_ptr
+//||if (pos) {
+//|  store_cell
+//||	for (unsigned int v = abs(pos), chunk; v; v -= chunk) {
+//||		chunk = arm_imm_chunk(v);
+//||		if (pos > 0) {
+//|  add   PTR, PTR, #chunk
+//||		} else {
+//|  sub   PTR, PTR, #chunk
+//||		}
+//||	}
+//||	cell = cell != NO_CELL && abs(cell - pos) <= MAX_OFFSET
+//||	     ? cell - pos : NO_CELL;
+//||	pos = 0;
+//||}
+//|.endmacro
+//|
+//|// NEON instructions the assembler has no encodings for.
+//|.macro vld1_q0_ptr;  .long 0xf4240a0f; .endmacro  // vld1.8 {d0, d1}, [PTR]
+//|.macro vld1_q0_r0;   .long 0xf4200a0f; .endmacro  // vld1.8 {d0, d1}, [r0]
+//|.macro vld2_d0_ptr;  .long 0xf424080f; .endmacro  // vld2.8 {d0, d1}, [PTR]
+//|.macro vld2_d0_r0;   .long 0xf420080f; .endmacro  // vld2.8 {d0, d1}, [r0]
+//|.macro vld4_d0_ptr;  .long 0xf424000f; .endmacro  // vld4.8 {d0-d3}, [PTR]
+//|.macro vld4_d0_r0;   .long 0xf420000f; .endmacro  // vld4.8 {d0-d3}, [r0]
+//|.macro vceqz_q0;     .long 0xf3b10140; .endmacro  // vceq.i8 q0, q0, #0
+//|.macro vceqz_d0;     .long 0xf3b10100; .endmacro  // vceq.i8 d0, d0, #0
+//|.macro vpmax_d4_q0;  .long 0xf3004a01; .endmacro  // vpmax.u8 d4, d0, d1
+//|.macro vmov_r01_d4;  .long 0xec510b14; .endmacro  // vmov r0, r1, d4
+//|.macro vmov_r01_d0;  .long 0xec510b10; .endmacro  // vmov r0, r1, d0
+//|.macro vmovz_q1;     .long 0xf2802e50; .endmacro  // vmov.i8 q1, #0
+//|.macro vst1_q1_r0;   .long 0xf4002a0d; .endmacro  // vst1.8 {d2, d3}, [r0]!
+//|.macro vst1_d2_r0;   .long 0xf400270d; .endmacro  // vst1.8 {d2}, [r0]!
+
+#define Dst &state
+#define IOBUF_SIZE 4096
+// Reach of ldrb/strb immediate offsets.
+#define MAX_OFFSET 4095
+#define NO_CELL (MAX_OFFSET + 1)
+
+// The part of v, starting from its lowest set bit, that fits an ARM
+// data-processing immediate: 8 bits rotated by an even amount.
+static unsigned int arm_imm_chunk(const unsigned int v)
+{
+	return v & (0xffu << (__builtin_ctz(v) & ~1));
+}
+
+// The stride of a scan loop such as [>] or [<<] at ops[open], or 0.
+static int scan_stride(const struct ir_prog * const prog, const int open)
+{
+	const struct ir *op = &prog->ops[open];
+	if (op->match != open + 2 || op[1].op != IR_MOVE ||
+	    abs(op[1].val) > MAX_OFFSET)
+		return 0;
+	return op[1].val;
+}
+
+// Strides that get a vector scan with NEON, in the order of their
+// pclabels.
+static const int scan_strides[] = { 1, -1, 2, -2, 4, -4 };
+#define SCANS ((int) (sizeof(scan_strides) / sizeof(scan_strides[0])))
+
+// The index in scan_strides of stride, or -1.
+static int scan_kernel(const int stride)
+{
+	for (int k = 0; k < SCANS; k++)
+		if (scan_strides[k] == stride) return k;
+	return -1;
+}
+
+// Clears shorter than this are left to plain stores.
+#define CLEAR_MIN 16
+// Longest clear, which keeps its start offset encodable.
+#define CLEAR_MAX 256
+
+// The number of cells cleared by the run of [-]>[-]>... or [-]<[-]<...
+// starting at ops[i], up to CLEAR_MAX.  Sets *dir to its direction.
+static int clear_run(const struct ir_prog * const prog, int i, int *dir)
+{
+	int n = 1;
+	*dir = 0;
+	while (n < CLEAR_MAX && i + 2 < prog->len &&
+	       prog->ops[i + 1].op == IR_MOVE &&
+	       abs(prog->ops[i + 1].val) == 1 &&
+	       (!*dir || prog->ops[i + 1].val == *dir) &&
+	       prog->ops[i + 2].op == IR_SET && prog->ops[i + 2].val == 0) {
+		*dir = prog->ops[i + 1].val;
+		i += 2;
+		n++;
+	}
+	return n;
+}
+
+// Whether the loop at ops[open] contains no other loop.
+static int innermost(const struct ir_prog * const prog, const int open)
+{
+	int i = open + 1;
+	while (prog->ops[i].op != IR_OPEN && prog->ops[i].op != IR_CLOSE)
+		i++;
+	return i == prog->ops[open].match;
+}
+
+int main(int argc, char *argv[])
+{
+	// Compact mode trades a little speed for code size, for programs
+	// whose code would not fit the instruction cache otherwise.  By
+	// default each , and . inlines its buffer access, and innermost
+	// loops, where the time goes, are aligned.  With -z each , and .
+	// calls a shared subroutine instead, and no loop is aligned.
+	const char * const usage = "Usage: jit-arm [-z] <inputfile>";
+	int compact = 0, opt;
+	while ((opt = getopt(argc, argv, "z")) != -1) {
+		switch (opt) {
+		case 'z': compact = 1; break;
+		default: err(usage);
+		}
+	}
+	if (optind != argc - 1) err(usage);
+	dasm_State *state;
+	initjit(&state, actions);
+
+	// With NEON, scans with a stride of 1, 2 or 4 either way run as
+	// vector scans and long runs of [-] become vector stores.
+	const int neon = (getauxval(AT_HWCAP) & HWCAP_ARM_NEON) != 0;
+
+	// pclabels 0 to 3 are the flush, refill, put and get subroutines,
+	// and the next SCANS the vector scans, emitted if used.
+	const unsigned int flush = 0, refill = 1, put = 2, get = 3;
+	const unsigned int scan_first = 4;
+	unsigned int maxpc = scan_first + SCANS, scans = 0;
+	dasm_growpc(&state, maxpc);
+	struct stack pcstack = { .size = 0, .items = NULL };
+	int top;
+
+	struct ir_prog prog;
+	FILE *fp = open_source(argv[optind]);
+	if (fp == NULL) err("Couldn't open file");
+	if (ir_parse(fp, &prog)) err("Unmatched brackets");
+	fclose(fp);
+	ir_propagate(&prog);
+
+	// Function prologue.
+	//|  push {r4, r5, r6, r7, r8, r9, r10, r11, lr}
+	//|  mov  PTR, r0
+	//|  mov  IOBUF, r1
+	//|  mov  OUTP, r1
+	//|  add  OUTEND, r1, #IOBUF_SIZE
+	//|  mov  INP, OUTEND
+	//|  mov  INEND, OUTEND
+	dasm_put(Dst, 0, IOBUF_SIZE);
+#line 196 "jit-arm.dasc"
+	if (neon) {
+		// q1 stays zero, for the block clears.
+		//|  vmovz_q1
+		dasm_put(Dst, 9);
+#line 199 "jit-arm.dasc"
+	}
+
+	int pos = 0, cell = NO_CELL, dirty = 0, n, dir, stride, k;
+	for (int i = 0; i < prog.len; i++) {
+		const struct ir *op = &prog.ops[i];
+		if (jit_section_full(&state)) err("Program too large to compile");
+		switch (op->op) {
+		case IR_MOVE:
+			pos += op->val;
+			if (abs(pos) > MAX_OFFSET) {
+				//|  sync_ptr
+				if (pos) {
+				if (dirty) {
+				dasm_put(Dst, 11, cell);
+					dirty = 0;
+				}
+					for (unsigned int v = abs(pos), chunk; v; v -= chunk) {
+						chunk = arm_imm_chunk(v);
+						if (pos > 0) {
+				dasm_put(Dst, 14, chunk);
+						} else {
+				dasm_put(Dst, 17, chunk);
+						}
+					}
+					cell = cell != NO_CELL && abs(cell - pos) <= MAX_OFFSET
+					     ? cell - pos : NO_CELL;
+					pos = 0;
+				}
+#line 210 "jit-arm.dasc"
+			}
+			break;
+		case IR_ADD:
+			//|  load_cell
+			if (cell != pos) {
+			if (dirty) {
+			dasm_put(Dst, 20, cell);
+				dirty = 0;
+			}
+			dasm_put(Dst, 23, pos);
+				cell = pos;
+			}
+#line 214 "jit-arm.dasc"
+			//|  add   r5, r5, #op->val
+			dasm_put(Dst, 26, op->val);
+#line 215 "jit-arm.dasc"
+			dirty = 1;
+			break;
+		case IR_SET:
+			if (neon && op->val == 0 &&
+			    (n = clear_run(&prog, i, &dir)) >= CLEAR_MIN) {
+				//|  sync_ptr
+				if (pos) {
+				if (dirty) {
+				dasm_put(Dst, 29, cell);
+					dirty = 0;
+				}
+					for (unsigned int v = abs(pos), chunk; v; v -= chunk) {
+						chunk = arm_imm_chunk(v);
+						if (pos > 0) {
+				dasm_put(Dst, 32, chunk);
+						} else {
+				dasm_put(Dst, 35, chunk);
+						}
+					}
+					cell = cell != NO_CELL && abs(cell - pos) <= MAX_OFFSET
+					     ? cell - pos : NO_CELL;
+					pos = 0;
+				}
+#line 221 "jit-arm.dasc"
+				//|  store_cell
+				if (dirty) {
+				dasm_put(Dst, 38, cell);
+					dirty = 0;
+				}
+#line 222 "jit-arm.dasc"
+				if (dir > 0) {
+					//|  mov   r0, PTR
+					dasm_put(Dst, 41);
+#line 224 "jit-arm.dasc"
+				} else {
+					//|  sub   r0, PTR, #n-1
+					dasm_put(Dst, 43, n-1);
+#line 226 "jit-arm.dasc"
+				}
+				for (int k = 0; k + 16 <= n; k += 16) {
+					//|  vst1_q1_r0
+					dasm_put(Dst, 46);
+#line 229 "jit-arm.dasc"
+				}
+				if (n % 16 >= 8) {
+					//|  vst1_d2_r0
+					dasm_put(Dst, 48);
+#line 232 "jit-arm.dasc"
+				}
+				if (n % 8) {
+					//|  mov   r1, #0
+					dasm_put(Dst, 50);
+#line 235 "jit-arm.dasc"
+				}
+				for (int k = 0; k < n % 8; k++) {
+					//|  strb  r1, [r0], #1
+					dasm_put(Dst, 52);
+#line 238 "jit-arm.dasc"
+				}
+				if (cell != NO_CELL && cell * dir >= 0 &&
+				    cell * dir < n)
+					cell = NO_CELL;
+				pos = dir * (n - 1);
+				i += 2 * (n - 1);
+				break;
+			}
+			if (cell != pos) {
+				//|  store_cell
+				if (dirty) {
+				dasm_put(Dst, 54, cell);
+					dirty = 0;
+				}
+#line 248 "jit-arm.dasc"
+				cell = pos;
+			}
+			//|  mov   r5, #op->val
+			dasm_put(Dst, 57, op->val);
+#line 251 "jit-arm.dasc"
+			dirty = 1;
+			break;
+		case IR_OUT:
+			//|  load_cell
+			if (cell != pos) {
+			if (dirty) {
+			dasm_put(Dst, 60, cell);
+				dirty = 0;
+			}
+			dasm_put(Dst, 63, pos);
+				cell = pos;
+			}
+#line 255 "jit-arm.dasc"
+			if (compact) {
+				//|  bl    =>(put)
+				dasm_put(Dst, 66, (put));
+#line 257 "jit-arm.dasc"
+				break;
+			}
+			//|  strb  r5, [OUTP], #1
+			//|  cmp   OUTP, OUTEND
+			//|  bleq  =>(flush)
+			dasm_put(Dst, 69, (flush));
+#line 262 "jit-arm.dasc"
+			break;
+		case IR_IN:
+			// At end of input the cell is left unchanged.
+			//|  load_cell
+			if (cell != pos) {
+			if (dirty) {
+			dasm_put(Dst, 74, cell);
+				dirty = 0;
+			}
+			dasm_put(Dst, 77, pos);
+				cell = pos;
+			}
+#line 266 "jit-arm.dasc"
+			dirty = 1;
+			if (compact) {
+				//|  bl    =>(get)
+				dasm_put(Dst, 80, (get));
+#line 269 "jit-arm.dasc"
+				break;
+			}
+			//|  cmp   INP, INEND
+			//|  bleq  =>(refill)
+			//|  cmp   INP, INEND
+			//|  ldrbne r5, [INP], #1
+			dasm_put(Dst, 83, (refill));
+#line 275 "jit-arm.dasc"
+			break;
+		case IR_OPEN:
+			//|  sync_ptr
+			if (pos) {
+			if (dirty) {
+			dasm_put(Dst, 89, cell);
+				dirty = 0;
+			}
+				for (unsigned int v = abs(pos), chunk; v; v -= chunk) {
+					chunk = arm_imm_chunk(v);
+					if (pos > 0) {
+			dasm_put(Dst, 92, chunk);
+					} else {
+			dasm_put(Dst, 95, chunk);
+					}
+				}
+				cell = cell != NO_CELL && abs(cell - pos) <= MAX_OFFSET
+				     ? cell - pos : NO_CELL;
+				pos = 0;
+			}
+#line 278 "jit-arm.dasc"
+			//|  store_cell
+			if (dirty) {
+			dasm_put(Dst, 98, cell);
+				dirty = 0;
+			}
+#line 279 "jit-arm.dasc"
+			if ((stride = scan_stride(&prog, i))) {
+				if (neon && (k = scan_kernel(stride)) >= 0) {
+					scans |= 1u << k;
+					//|  bl    =>(scan_first + k)
+					dasm_put(Dst, 101, (scan_first + k));
+#line 283 "jit-arm.dasc"
+				} else {
+					// Step and test in one load.
+					if (!op->val) {
+						//|  ldrb  r5, [PTR]
+						//|  cmp   r5, #0
+						//|  beq   >2
+						dasm_put(Dst, 104);
+#line 289 "jit-arm.dasc"
+					}
+					//|1:
+					//|  ldrb  r5, [PTR, #stride]!
+					//|  cmp   r5, #0
+					//|  bne   <1
+					//|2:
+					dasm_put(Dst, 109, stride);
+#line 295 "jit-arm.dasc"
+				}
+				cell = 0;
+				i += 2;
+				break;
+			}
+			// Each loop gets two pclabels: the test at its bottom
+			// and the start of its body.  We store them in a stack
+			// to link the loop begin and end together.
+			maxpc += 2;     // add two labels
+			if (stack_push(&pcstack, maxpc)) err("Out of memory.");
+			dasm_growpc(&state, maxpc);
+			// Rotated loop: enter at the test on the bottom, so
+			// each iteration takes a single backward branch.
+			// Constant propagation may prove the entry test passes.
+			if (!op->val) {
+				//|  b     =>(maxpc-2)
+				dasm_put(Dst, 117, (maxpc-2));
+#line 311 "jit-arm.dasc"
+			}
+			if (!compact && innermost(&prog, i)) {
+				//|.align 16
+				dasm_put(Dst, 120);
+#line 314 "jit-arm.dasc"
+			}
+			//|=>(maxpc-1):
+			dasm_put(Dst, 122, (maxpc-1));
+#line 316 "jit-arm.dasc"
+			// The test leaves the loop's cell in r5.
+			cell = op->val ? NO_CELL : 0;
+			break;
+		case IR_CLOSE:
+			stack_pop(&pcstack, &top);
+			//|  sync_ptr
+			if (pos) {
+			if (dirty) {
+			dasm_put(Dst, 124, cell);
+				dirty = 0;
+			}
+				for (unsigned int v = abs(pos), chunk; v; v -= chunk) {
+					chunk = arm_imm_chunk(v);
+					if (pos > 0) {
+			dasm_put(Dst, 127, chunk);
+					} else {
+			dasm_put(Dst, 130, chunk);
+					}
+				}
+				cell = cell != NO_CELL && abs(cell - pos) <= MAX_OFFSET
+				     ? cell - pos : NO_CELL;
+				pos = 0;
+			}
+#line 322 "jit-arm.dasc"
+			if (cell == 0) {
+				// Test the cached cell on the way in.  It may
+				// have carried past 8 bits, so only its low
+				// byte counts.
+				//|  store_cell
+				if (dirty) {
+				dasm_put(Dst, 133, cell);
+					dirty = 0;
+				}
+#line 327 "jit-arm.dasc"
+				//|  tst   r5, #255
+				//|  bne   =>(top-1)
+				dasm_put(Dst, 136, (top-1));
+#line 329 "jit-arm.dasc"
+				if (!prog.ops[op->match].val) {
+					//|  b     >1
+					dasm_put(Dst, 140);
+#line 331 "jit-arm.dasc"
+				}
+			} else {
+				//|  store_cell
+				if (dirty) {
+				dasm_put(Dst, 143, cell);
+					dirty = 0;
+				}
+#line 334 "jit-arm.dasc"
+			}
+			if (cell != 0 || !prog.ops[op->match].val) {
+				//|=>(top-2):
+				//|  ldrb  r5, [PTR]
+				//|  cmp   r5, #0
+				//|  bne   =>(top-1)
+				dasm_put(Dst, 146, (top-2), (top-1));
+#line 340 "jit-arm.dasc"
+			}
+			//|1:
+			dasm_put(Dst, 152);
+#line 342 "jit-arm.dasc"
+			cell = 0;
+			break;
+		}
+	}
+	stack_free(&pcstack);
+	ir_free(&prog);
+
+	// Function epilogue.
+	//|  bl   =>(flush)
+	//|  pop  {r4, r5, r6, r7, r8, r9, r10, r11, pc}
+	dasm_put(Dst, 154, (flush));
+#line 352 "jit-arm.dasc"
+
+	// The vector scans move PTR to the first zero cell it reaches,
+	// testing a block of cells at a time and then one by one inside the
+	// block holding it: 16 cells at stride 1, and 8 at strides 2 and 4,
+	// whose cells vld2 and vld4 gather into d0.  Backward scans load the
+	// block ending at PTR.
+	for (k = 0; k < SCANS; k++) {
+		const int s = scan_strides[k], block = abs(s) == 1 ? 16 : 8;
+		if (!(scans & 1u << k)) continue;
+		//|=>(scan_first + k):
+		//|1:
+		dasm_put(Dst, 158, (scan_first + k));
+#line 363 "jit-arm.dasc"
+		if (s < 0) {
+			//|  sub   r0, PTR, #(block - 1) * -s
+			dasm_put(Dst, 161, (block - 1) * -s);
+#line 365 "jit-arm.dasc"
+		}
+		switch (s) {
+		case 1:
+			//|  vld1_q0_ptr
+			dasm_put(Dst, 164);
+#line 369 "jit-arm.dasc"
+			break;
+		case -1:
+			//|  vld1_q0_r0
+			dasm_put(Dst, 166);
+#line 372 "jit-arm.dasc"
+			break;
+		case 2:
+			//|  vld2_d0_ptr
+			dasm_put(Dst, 168);
+#line 375 "jit-arm.dasc"
+			break;
+		case -2:
+			//|  vld2_d0_r0
+			dasm_put(Dst, 170);
+#line 378 "jit-arm.dasc"
+			break;
+		case 4:
+			//|  vld4_d0_ptr
+			dasm_put(Dst, 172);
+#line 381 "jit-arm.dasc"
+			break;
+		case -4:
+			//|  vld4_d0_r0
+			dasm_put(Dst, 174);
+#line 384 "jit-arm.dasc"
+			break;
+		}
+		if (block == 16) {
+			//|  vceqz_q0
+			//|  vpmax_d4_q0
+			//|  vmov_r01_d4
+			dasm_put(Dst, 176);
+#line 390 "jit-arm.dasc"
+		} else {
+			//|  vceqz_d0
+			//|  vmov_r01_d0
+			dasm_put(Dst, 180);
+#line 393 "jit-arm.dasc"
+		}
+		//|  orrs  r0, r0, r1
+		dasm_put(Dst, 183);
+#line 395 "jit-arm.dasc"
+		if (s > 0) {
+			//|  addeq PTR, PTR, #block * s
+			dasm_put(Dst, 185, block * s);
+#line 397 "jit-arm.dasc"
+		} else {
+			//|  subeq PTR, PTR, #block * -s
+			dasm_put(Dst, 188, block * -s);
+#line 399 "jit-arm.dasc"
+		}
+		//|  beq   <1
+		//|2:
+		//|  ldrb  r5, [PTR]
+		//|  cmp   r5, #0
+		//|  bxeq  lr
+		dasm_put(Dst, 191);
+#line 405 "jit-arm.dasc"
+		if (s > 0) {
+			//|  add   PTR, PTR, #s
+			dasm_put(Dst, 198, s);
+#line 407 "jit-arm.dasc"
+		} else {
+			//|  sub   PTR, PTR, #-s
+			dasm_put(Dst, 201, -s);
+#line 409 "jit-arm.dasc"
+		}
+		//|  b     <2
+		dasm_put(Dst, 204);
+#line 411 "jit-arm.dasc"
+	}
+
+	if (compact) {
+		// Appends r5 to the output.
+		//|=>(put):
+		//|  strb  r5, [OUTP], #1
+		//|  cmp   OUTP, OUTEND
+		//|  bxne  lr
+		//|  b     =>(flush)
+		dasm_put(Dst, 207, (put), (flush));
+#line 420 "jit-arm.dasc"
+
+		// Reads the next input byte into r5, if there is one.
+		//|=>(get):
+		//|  cmp   INP, INEND
+		//|  ldrbne r5, [INP], #1
+		//|  bxne  lr
+		//|  push  {r0, lr}
+		//|  bl    =>(refill)
+		//|  pop   {r0, lr}
+		//|  cmp   INP, INEND
+		//|  ldrbne r5, [INP], #1
+		//|  bx    lr
+		dasm_put(Dst, 214, (get), (refill));
+#line 432 "jit-arm.dasc"
+	}
+
+	// Writes out the output buffer and empties it.  Output that cannot
+	// be written is dropped, as a failed putchar would.
+	//|=>(flush):
+	//|  mov  r1, IOBUF
+	//|1:
+	//|  subs r2, OUTP, r1
+	//|  beq  >2
+	//|  mov  r0, #1   // stdout
+	//|  mov  r7, #4   // sys_write
+	//|  svc  #0
+	//|  cmp  r0, #0
+	//|  ble  >2
+	//|  add  r1, r1, r0
+	//|  b    <1
+	//|2:
+	//|  mov  OUTP, IOBUF
+	//|  bx   lr
+	dasm_put(Dst, 226, (flush));
+#line 451 "jit-arm.dasc"
+
+	// Refills the empty input buffer, leaving it empty at end of input.
+	// Output is flushed first so prompts appear before we block.
+	//|=>(refill):
+	//|  push {r0, lr}
+	//|  bl   =>(flush)
+	//|  mov  r0, #0   // stdin
+	//|  mov  r1, OUTEND
+	//|  mov  r2, #IOBUF_SIZE
+	//|  mov  r7, #3   // sys_read
+	//|  svc  #0
+	//|  mov  INP, OUTEND
+	//|  cmp  r0, #0
+	//|  addgt INEND, INP, r0
+	//|  movle INEND, INP
+	//|  pop  {r0, pc}
+	dasm_put(Dst, 245, (refill), (flush), IOBUF_SIZE);
+#line 467 "jit-arm.dasc"
+
+	void (*fptr)(char *, char *) = jitcode(&state);
+	dasm_free(&state);
+	if (fptr == NULL) err("Out of memory");
+	// The vector scans may read up to 28 cells before the tape and 31
+	// after it, so it gets 32 bytes of slack in front; the I/O buffers
+	// follow it.
+	char *mem = calloc(32 + 30000 + 2 * IOBUF_SIZE, 1);
+	fptr(mem + 32, mem + 32 + 30000);
+	free(mem);
+	free_jitcode(fptr);
+	return 0;
+}
@@ -0,0 +1,1633 @@
+/*
+** This file has been pre-processed with DynASM.
+** http://luajit.org/dynasm.html
+** DynASM version 1.3.0, DynASM x64 version 1.3.0
+** DO NOT EDIT! The original file is in "jit-x64.dasc".
+*/
+
+#line 1 "jit-x64.dasc"
+#include <stdint.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include "ir.h"
+#include "batch.h"
+#include "checkpoint.h"
+#include "sandbox.h"
+#include "profile.h"
+#include "served.h"
+#include "trace.h"
+
+//|.arch x64
+#if DASM_VERSION != 10300
+#error "Version mismatch between DynASM and included encoding engine"
+#endif
+#line 13 "jit-x64.dasc"
+//|.section code, cold, outline
+#define DASM_SECTION_CODE	0
+#define DASM_SECTION_COLD	1
+#define DASM_SECTION_OUTLINE	2
+#define DASM_MAXSECTION		3
+#line 14 "jit-x64.dasc"
+//|.actionlist actions
+static const unsigned char actions[629] = {
+  102,15,252,239,192,72,137,222,72,131,230,252,240,72,137,217,131,225,15,255,
+  102,15,111,14,102,15,116,200,102,15,215,193,255,211,232,133,192,15,133,244,
+  248,248,1,72,131,198,16,102,15,111,14,102,15,116,200,102,15,215,193,133,192,
+  15,132,244,1,15,188,192,72,141,28,6,252,233,244,249,248,2,15,188,192,72,1,
+  195,248,3,255,131,252,241,15,211,224,15,183,192,133,192,15,133,244,248,248,
+  1,72,131,252,238,16,102,15,111,14,102,15,116,200,102,15,215,193,133,192,15,
+  132,244,1,15,189,192,72,141,28,6,252,233,244,249,248,2,15,189,192,41,200,
+  72,141,28,6,248,3,255,83,65,84,65,85,65,86,85,65,87,72,131,252,236,8,72,137,
+  252,251,73,137,252,244,73,137,213,77,137,198,72,133,201,15,132,244,247,252,
+  255,225,248,1,255,72,129,195,239,255,65,128,192,235,255,65,128,193,235,255,
+  65,128,194,235,255,65,128,195,235,255,64,128,198,235,255,64,128,199,235,255,
+  128,131,233,235,255,65,176,235,255,65,177,235,255,65,178,235,255,65,179,235,
+  255,64,182,235,255,64,183,235,255,198,131,233,235,255,252,233,244,247,248,
+  2,254,1,77,133,252,246,15,136,245,255,68,136,131,233,255,68,136,139,233,255,
+  68,136,147,233,255,68,136,155,233,255,64,136,179,233,255,64,136,187,233,255,
+  15,182,187,233,76,137,252,238,255,232,243,255,72,184,237,237,252,255,208,
+  255,68,138,131,233,255,68,138,139,233,255,68,138,147,233,255,68,138,155,233,
+  255,64,138,179,233,255,64,138,187,233,255,252,233,244,2,255,254,2,254,0,76,
+  137,231,255,252,233,245,255,128,59,0,15,133,245,255,249,254,2,249,255,68,
+  15,182,59,255,15,182,43,255,65,252,255,199,255,252,255,197,255,250,15,249,
+  255,65,128,252,248,0,255,65,128,252,249,0,255,65,128,252,250,0,255,65,128,
+  252,251,0,255,64,128,252,254,0,255,64,128,252,255,0,255,15,132,245,255,73,
+  129,252,238,239,255,72,184,237,237,131,56,0,15,133,244,247,254,1,248,1,72,
+  184,237,237,72,199,0,237,72,137,88,8,252,233,245,255,65,252,255,207,255,252,
+  255,205,255,198,3,0,255,252,233,245,254,0,249,76,137,252,240,72,131,196,8,
+  65,95,93,65,94,65,93,65,92,91,195,255,83,65,84,65,85,65,87,72,131,252,236,
+  8,73,137,252,255,72,139,31,73,137,252,244,73,137,213,250,15,249,255,128,187,
+  233,0,255,15,132,244,247,255,15,133,244,247,255,252,233,243,255,72,184,237,
+  237,252,255,224,255,184,237,252,233,245,255,184,237,255,249,72,185,237,237,
+  72,139,20,193,72,133,210,15,132,244,247,252,255,226,248,1,73,137,31,72,131,
+  196,8,65,95,65,93,65,92,91,195,255
+};
+
+#line 15 "jit-x64.dasc"
+//|
+//|// Use rbx as our cell pointer, and r12/r13 for the input and
+//|// output streams.  Since they are callee-save registers, they will
+//|// be preserved across our calls to getc and putc.
+//|.define PTR, rbx
+//|.define IN, r12
+//|.define OUT, r13
+//|// Sandboxed code counts its remaining fuel down in r14.
+//|.define FUEL, r14
+//|
+//|// Counted loops count their iterations down in ebp and r15d, also
+//|// callee-save so they survive I/O calls; n picks which.
+//|.macro ctrop, n, mn
+//||if (n) {
+//|  mn  r15d
+//||} else {
+//|  mn  ebp
+//||}
+//|.endmacro
+//|
+//|.macro ctrload, n
+//||if (n) {
+//|  movzx r15d, byte [PTR]
+//||} else {
+//|  movzx ebp, byte [PTR]
+//||}
+//|.endmacro
+//|
+//|.macro ctrstore, n
+//||if (n) {
+//|  mov  byte [PTR], r15b
+//||} else {
+//|  mov  byte [PTR], bpl
+//||}
+//|.endmacro
+//|
+//|// Macro for calling a function.
+//|// In cases where our target is <=2**31 away we can use
+//|//   | call &addr
+//|// The driver places code close to the C library so that is usually
+//|// the case, otherwise we fall back to this safe sequence instead.
+//|.macro callp, addr
+//||if (jit_rel_target((void *)addr)) {
+//|  call   &jit_rel_target((void *)addr)
+//||} else {
+//|  mov64  rax, (uintptr_t)addr
+//|  call   rax
+//||}
+//|.endmacro
+//|
+//|// Jumps to code elsewhere in the heap, the same way.
+//|.macro jmpp, addr
+//||if (jit_rel_target(addr)) {
+//|  jmp    &jit_rel_target(addr)
+//||} else {
+//|  mov64  rax, (uintptr_t)addr
+//|  jmp    rax
+//||}
+//|.endmacro
+//|
+//|// Cells held in registers are numbered 0 to CELL_REGS-1 and live in
+//|// caller-saved registers, so they are spilled around every call.
+//|// mn reg, src  for cell register n.
+//|.macro regop, n, mn, src
+//||switch (n) {
+//||case 0:
+//|  mn  r8b, src
+//||break; case 1:
+//|  mn  r9b, src
+//||break; case 2:
+//|  mn  r10b, src
+//||break; case 3:
+//|  mn  r11b, src
+//||break; case 4:
+//|  mn  r6b, src
+//||break; case 5:
+//|  mn  r7b, src
+//||break; case 6:
+//|  mn  r2b, src
+//||break; default:
+//|  mn  r1b, src
+//||}
+//|.endmacro
+//|
+//|// mov dst, reg  for cell register n.
+//|.macro regstore, n, dst
+//||switch (n) {
+//||case 0:
+//|  mov  dst, r8b
+//||break; case 1:
+//|  mov  dst, r9b
+//||break; case 2:
+//|  mov  dst, r10b
+//||break; case 3:
+//|  mov  dst, r11b
+//||break; case 4:
+//|  mov  dst, r6b
+//||break; case 5:
+//|  mov  dst, r7b
+//||break; case 6:
+//|  mov  dst, r2b
+//||break; default:
+//|  mov  dst, r1b
+//||}
+//|.endmacro
+//|
+//|.macro load_cells
+//||for (int k = 0; k < ncells; k++) {
+//||	int off = cells[k];
+//|	regop k, mov, byte [PTR+off]
+//||}
+//|.endmacro
+//|
+//|// I/O is slow anyway, so sandboxed code checks its fuel there rather
+//|// than leave it to the timer, which skips time spent in the C library.
+//|.macro check_fuel
+//||if (sandbox) {
+//|  test FUEL, FUEL
+//|  js   =>(done)
+//||}
+//|.endmacro
+//|
+//|.macro spill_cells
+//||for (int k = 0; k < ncells; k++) {
+//||	int off = cells[k];
+//|	regstore k, byte [PTR+off]
+//||}
+//|.endmacro
+//|
+//|// Returns from a cold stub to the section the loop being compiled is in:
+//|// loops the profile says never run are placed after the cold stubs.
+//|.macro back_to_loop
+//||if (outlined >= 0) {
+//|.outline
+//||} else {
+//|.code
+//||}
+//|.endmacro
+
+#define Dst &state
+#define CELL_REGS 8
+// Counter registers for counted loops.
+#define COUNTERS 2
+// Most copies of a loop body unrolled for a steady trip count.
+#define UNROLL_MAX 4
+// Shortest average scan distance, in cells, that uses the SSE2 kernel.
+#define SCAN_SIMD_MIN 16
+
+// Flags for compile_ir().
+enum {
+	COMPILE_SANDBOX = 1,
+	COMPILE_CHECKPOINT = 2,
+};
+
+// Where checkpointing code stopped: the IR_CLOSE it stopped at, or -1,
+// and its pointer.
+static struct {
+	long pc;
+	uint8_t *ptr;
+} checkpoint_at = { -1, NULL };
+
+// Loop profile guiding compile_ir() (-g), or NULL.  See profile.h.
+static struct profile *guide;
+
+// Picks the cells to keep in registers for the loop at ops[open].  Only
+// innermost loops that leave the pointer where they found it qualify;
+// their pointer moves fold into the offsets of the cells they touch.
+// Fills cells with up to CELL_REGS offsets, most used first, and returns
+// how many there are (0 if the loop does not qualify).  The loop's own
+// cell, offset 0, always comes first.
+static int alloc_cells(const struct ir_prog * const prog, const int open,
+                       int cells[CELL_REGS])
+{
+	struct { int off, uses; } seen[64];
+	int nseen = 0, pos = 0;
+
+	for (int i = open + 1; i < prog->ops[open].match; i++) {
+		const struct ir *op = &prog->ops[i];
+		if (op->op == IR_OPEN) return 0;
+		if (op->op == IR_MOVE) {
+			pos += op->val;
+			continue;
+		}
+		int j = 0;
+		while (j < nseen && seen[j].off != pos) j++;
+		if (j == nseen) {
+			if (nseen == 64) return 0;
+			seen[nseen].off = pos;
+			seen[nseen++].uses = 0;
+		}
+		seen[j].uses++;
+	}
+	if (pos != 0) return 0;
+
+	int ncells = 0;
+	cells[ncells++] = 0;
+	while (ncells < CELL_REGS) {
+		int best = -1;
+		for (int j = 0; j < nseen; j++) {
+			int taken = 0;
+			for (int k = 0; k < ncells; k++)
+				taken |= cells[k] == seen[j].off;
+			if (!taken && (best < 0 || seen[j].uses > seen[best].uses))
+				best = j;
+		}
+		if (best < 0) break;
+		cells[ncells++] = seen[best].off;
+	}
+	return ncells;
+}
+
+enum {
+	COUNTED = 1,        // counts down in a register
+	COUNTED_UNREAD = 2, // and the register can stand in for the cell
+};
+
+// Recognizes loops with inner loops that still run exactly their cell's
+// value times: the pointer comes back to where it started, every inner
+// loop is balanced, and the loop's own cell only changes by a net -1 per
+// iteration, outside inner loops.  Their test can count down a register
+// instead of reading the tape.  Returns 0 if the loop at ops[open] is
+// not one, COUNTED if it is, and COUNTED | COUNTED_UNREAD if nothing in
+// the body reads the cell either, so it can be left alone until the
+// loop ends.
+static int counted_loop(const struct ir_prog * const prog, const int open)
+{
+	struct stack base = { .size = 0, .items = NULL };
+	int pos = 0, step = 0, inner = 0, start = 0;
+	int status = COUNTED | COUNTED_UNREAD;
+
+	if (prog->ops[open].match - open > IR_SCAN_LIMIT) return 0;
+	for (int i = open + 1; i < prog->ops[open].match && status; i++) {
+		const struct ir *op = &prog->ops[i];
+		switch (op->op) {
+		case IR_MOVE:
+			pos += op->val;
+			break;
+		case IR_ADD:
+			if (pos == 0 && base.size) status = 0;
+			else if (pos == 0) step += op->val;
+			break;
+		case IR_SET:
+		case IR_IN:
+			if (pos == 0) status = 0;
+			break;
+		case IR_OUT:
+			if (pos == 0) status &= ~COUNTED_UNREAD;
+			break;
+		case IR_OPEN:
+			// An inner loop on the cell would zero it.
+			if (pos == 0) status = 0;
+			if (stack_push(&base, pos)) err("Out of memory.");
+			inner = 1;
+			break;
+		case IR_CLOSE:
+			stack_pop(&base, &start);
+			if (pos != start) status = 0;
+			break;
+		}
+	}
+	stack_free(&base);
+	if (pos != 0 || !inner || (step & 0xff) != 0xff) return 0;
+	return status;
+}
+
+// The fuel a loop charges per iteration: one per operation in its body,
+// with nested loops counting once, plus one for the test.
+static int loop_cost(const struct ir_prog * const prog, const int open)
+{
+	int cost = 1;
+	for (int i = open + 1; i < prog->ops[open].match; i++) {
+		cost++;
+		if (prog->ops[i].op == IR_OPEN)
+			i = prog->ops[i].match;
+	}
+	return cost;
+}
+
+// How far a cell access can land from the previous one, which is what
+// the sandbox's guard pages have to cover.  Conservative: cells kept in
+// registers are all touched at the loop head and exit, so those loops
+// count twice their total movement.
+static long access_reach(const struct ir_prog * const prog)
+{
+	int cells[CELL_REGS];
+	long reach = 0, drift = 0, body = 0;
+
+	for (int i = 0; i < prog->len; i++) {
+		const struct ir *op = &prog->ops[i];
+		switch (op->op) {
+		case IR_MOVE:
+			drift += labs(op->val);
+			continue;
+		case IR_OPEN:
+			body = 0;
+			if (alloc_cells(prog, i, cells)) {
+				for (int j = i; j < op->match; j++)
+					if (prog->ops[j].op == IR_MOVE)
+						body += labs(prog->ops[j].val);
+				drift += 2 * body;
+			} else if (op->val) {
+				// Known nonzero: the entry test is skipped.
+				continue;
+			}
+			break;
+		case IR_CLOSE:
+			if (reach < drift) reach = drift;
+			// The exit spills cells up to body away.
+			drift = body;
+			body = 0;
+			continue;
+		default:
+			break;
+		}
+		if (reach < drift) reach = drift;
+		drift = 0;
+	}
+	return reach;
+}
+
+// The cell register holding offset off, or -1.
+static int cell_reg(const int * const cells, const int ncells, const int off)
+{
+	for (int k = 0; k < ncells; k++)
+		if (cells[k] == off) return k;
+	return -1;
+}
+
+// Emits a scan loop, [>] for step 1 or [<] for -1, that checks 16 cells
+// at a time.  The loads are aligned, so they never cross into a page
+// the scan does not reach.
+static void emit_scan(dasm_State *state, const int step)
+{
+	//|  pxor   xmm0, xmm0
+	//|  mov    rsi, PTR
+	//|  and    rsi, -16
+	//|  mov    rcx, PTR
+	//|  and    ecx, 15
+	dasm_put(Dst, 0);
+#line 353 "jit-x64.dasc"
+	// The zero cells of the first block, from the pointer on.
+	//|  movdqa xmm1, [rsi]
+	//|  pcmpeqb xmm1, xmm0
+	//|  pmovmskb eax, xmm1
+	dasm_put(Dst, 20);
+#line 357 "jit-x64.dasc"
+	if (step > 0) {
+		//|  shr    eax, cl
+		//|  test   eax, eax
+		//|  jnz    >2
+		//|1:
+		//|  add    rsi, 16
+		//|  movdqa xmm1, [rsi]
+		//|  pcmpeqb xmm1, xmm0
+		//|  pmovmskb eax, xmm1
+		//|  test   eax, eax
+		//|  jz     <1
+		//|  bsf    eax, eax
+		//|  lea    PTR, [rsi+rax]
+		//|  jmp    >3
+		//|2:
+		//|  bsf    eax, eax
+		//|  add    PTR, rax
+		//|3:
+		dasm_put(Dst, 33);
+#line 375 "jit-x64.dasc"
+	} else {
+		//|  xor    ecx, 15
+		//|  shl    eax, cl
+		//|  movzx  eax, ax
+		//|  test   eax, eax
+		//|  jnz    >2
+		//|1:
+		//|  sub    rsi, 16
+		//|  movdqa xmm1, [rsi]
+		//|  pcmpeqb xmm1, xmm0
+		//|  pmovmskb eax, xmm1
+		//|  test   eax, eax
+		//|  jz     <1
+		//|  bsr    eax, eax
+		//|  lea    PTR, [rsi+rax]
+		//|  jmp    >3
+		//|2:
+		//|  bsr    eax, eax
+		//|  sub    eax, ecx
+		//|  lea    PTR, [rsi+rax]
+		//|3:
+		dasm_put(Dst, 87);
+#line 396 "jit-x64.dasc"
+	}
+}
+
+// Compiles prog into a bf_fn, or returns NULL if it is too large for
+// DynASM or there is no room for the code.  If entry is not NULL it
+// receives, for each IR_OPEN and IR_CLOSE, the address that resumes
+// execution just before that operation's test.  With COMPILE_SANDBOX the code charges
+// fuel at every loop test; see sandbox.h for how running out is caught.
+// With COMPILE_CHECKPOINT, loops that contain other loops check for a
+// checkpoint request at their test, and if there is one return with the
+// place they stopped in checkpoint_at.  Innermost loops are not checked,
+// to keep them fast; they rarely run long without an outer loop's test.
+// Counted loops keep state in registers that resuming could not
+// restore, so they are only used when entry is NULL.
+// With a profile in guide, loops that never ran are moved out of line,
+// innermost loops that always made the same few trips are unrolled,
+// and scan loops that go far use an SSE2 kernel.
+static bf_fn compile_ir(const struct ir_prog * const prog, void **entry,
+                        const int flags)
+{
+	const int sandbox = flags & COMPILE_SANDBOX;
+	dasm_State *state;
+	initjit(&state, actions);
+
+	unsigned int maxpc = 0;
+	struct stack pcstack = { .size = 0, .items = NULL };
+	int top = 0;
+
+	// Size the pclabel array once for every loop up front.
+	unsigned int loops = 0;
+	for (int i = 0; i < prog->len; i++)
+		loops += prog->ops[i].op == IR_OPEN;
+	// Plus one for the epilogue.
+	dasm_growpc(&state, 5 * loops + 1);
+	const unsigned int done = 5 * loops;
+
+	// Function prologue.
+	//|  push PTR
+	//|  push IN
+	//|  push OUT
+	//|  push FUEL
+	//|  push rbp
+	//|  push r15
+	//|  sub  rsp, 8        // keep the stack 16 byte aligned for calls
+	//|  mov  PTR, rdi      // rdi store 1st argument
+	//|  mov  IN, rsi
+	//|  mov  OUT, rdx
+	//|  mov  FUEL, r8
+	//|  test rcx, rcx
+	//|  jz   >1
+	//|  jmp  rcx
+	//|1:
+	dasm_put(Dst, 152);
+#line 448 "jit-x64.dasc"
+
+	// Loops are rotated: the entry jumps straight to the test at the
+	// bottom, so each iteration runs a single compare and backward
+	// branch, and the body starts on a 16 byte boundary.  I/O calls
+	// are moved out of line into the cold section, keeping loop
+	// bodies dense.
+	//
+	// Inside innermost balanced loops the pointer stays put: moves fold
+	// into the offset pos, and the most used cells are loaded into
+	// registers at the head and spilled at the exit and around I/O.
+	int cells[CELL_REGS], ncells = 0, pos = 0, r, last_open = -1;
+	// Counted loops being compiled, innermost last; the one at index
+	// k counts in counter register k.  pos tracks the pointer from
+	// the loop's cell so the body's decrements of it can be found.
+	struct {
+		int open, unread, pos;
+	} counted[COUNTERS];
+	int ncounted = 0, k;
+	// The IR_CLOSE ending the loop moved out of line, or -1; and the
+	// body copies left to unroll into the current innermost loop.
+	int outlined = -1, unroll = 0, unrolled = 0;
+	const struct profile_loop *l;
+
+	for (int i = 0; i < prog->len; i++) {
+		const struct ir *op = &prog->ops[i];
+		// The pclabel that resumes at this op, if any.
+		int resume = -1;
+		if (jit_section_full(&state)) {
+			if (entry) memset(entry, 0, prog->len * sizeof(*entry));
+			dasm_free(&state);
+			stack_free(&pcstack);
+			return NULL;
+		}
+		switch (op->op) {
+		case IR_MOVE:
+			for (k = 0; k < ncounted; k++)
+				counted[k].pos += op->val;
+			if (ncells) {
+				pos += op->val;
+				break;
+			}
+			//|  add  PTR, op->val
+			dasm_put(Dst, 194, op->val);
+#line 490 "jit-x64.dasc"
+			break;
+		case IR_ADD:
+			// The counter stands in for an unread cell.
+			for (k = 0; k < ncounted; k++)
+				if (counted[k].unread && !counted[k].pos) break;
+			if (k < ncounted)
+				break;
+			if ((r = cell_reg(cells, ncells, pos)) >= 0) {
+				//|  regop r, add, op->val
+				switch (r) {
+				case 0:
+				dasm_put(Dst, 199, op->val);
+				break; case 1:
+				dasm_put(Dst, 204, op->val);
+				break; case 2:
+				dasm_put(Dst, 209, op->val);
+				break; case 3:
+				dasm_put(Dst, 214, op->val);
+				break; case 4:
+				dasm_put(Dst, 219, op->val);
+				break; case 5:
+				dasm_put(Dst, 224, op->val);
+				break; case 6:
+				dasm_put(Dst, 210, op->val);
+				break; default:
+				dasm_put(Dst, 205, op->val);
+				}
+#line 499 "jit-x64.dasc"
+			} else {
+				//|  add  byte [PTR+pos], op->val
+				dasm_put(Dst, 229, pos, op->val);
+#line 501 "jit-x64.dasc"
+			}
+			break;
+		case IR_SET:
+			if ((r = cell_reg(cells, ncells, pos)) >= 0) {
+				//|  regop r, mov, op->val
+				switch (r) {
+				case 0:
+				dasm_put(Dst, 234, op->val);
+				break; case 1:
+				dasm_put(Dst, 238, op->val);
+				break; case 2:
+				dasm_put(Dst, 242, op->val);
+				break; case 3:
+				dasm_put(Dst, 246, op->val);
+				break; case 4:
+				dasm_put(Dst, 250, op->val);
+				break; case 5:
+				dasm_put(Dst, 254, op->val);
+				break; case 6:
+				dasm_put(Dst, 243, op->val);
+				break; default:
+				dasm_put(Dst, 239, op->val);
+				}
+#line 506 "jit-x64.dasc"
+			} else {
+				//|  mov  byte [PTR+pos], op->val
+				dasm_put(Dst, 258, pos, op->val);
+#line 508 "jit-x64.dasc"
+			}
+			break;
+		case IR_OUT:
+			//|  jmp   >1
+			//|2:
+			//|.cold
+			dasm_put(Dst, 263);
+#line 514 "jit-x64.dasc"
+			//|1:
+			//|  check_fuel
+			dasm_put(Dst, 191);
+			if (sandbox) {
+			dasm_put(Dst, 271, (done));
+			}
+#line 516 "jit-x64.dasc"
+			//|  spill_cells
+			for (int k = 0; k < ncells; k++) {
+				int off = cells[k];
+			switch (k) {
+			case 0:
+			dasm_put(Dst, 279, off);
+			break; case 1:
+			dasm_put(Dst, 284, off);
+			break; case 2:
+			dasm_put(Dst, 289, off);
+			break; case 3:
+			dasm_put(Dst, 294, off);
+			break; case 4:
+			dasm_put(Dst, 299, off);
+			break; case 5:
+			dasm_put(Dst, 304, off);
+			break; case 6:
+			dasm_put(Dst, 290, off);
+			break; default:
+			dasm_put(Dst, 285, off);
+			}
+			}
+#line 517 "jit-x64.dasc"
+			//|  movzx edi, byte [PTR+pos]
+			//|  mov   rsi, OUT
+			//|  callp putc_unlocked
+			dasm_put(Dst, 309, pos);
+			if (jit_rel_target((void *)putc_unlocked)) {
+			dasm_put(Dst, 318, (ptrdiff_t)(jit_rel_target((void *)putc_unlocked)));
+			} else {
+			dasm_put(Dst, 321, (unsigned int)((uintptr_t)putc_unlocked), (unsigned int)(((uintptr_t)putc_unlocked)>>32));
+			}
+#line 520 "jit-x64.dasc"
+			//|  load_cells
+			for (int k = 0; k < ncells; k++) {
+				int off = cells[k];
+			switch (k) {
+			case 0:
+			dasm_put(Dst, 329, off);
+			break; case 1:
+			dasm_put(Dst, 334, off);
+			break; case 2:
+			dasm_put(Dst, 339, off);
+			break; case 3:
+			dasm_put(Dst, 344, off);
+			break; case 4:
+			dasm_put(Dst, 349, off);
+			break; case 5:
+			dasm_put(Dst, 354, off);
+			break; case 6:
+			dasm_put(Dst, 340, off);
+			break; default:
+			dasm_put(Dst, 335, off);
+			}
+			}
+#line 521 "jit-x64.dasc"
+			//|  jmp   <2
+			//|  back_to_loop
+			dasm_put(Dst, 359);
+			if (outlined >= 0) {
+			dasm_put(Dst, 364);
+			} else {
+			dasm_put(Dst, 366);
+			}
+#line 523 "jit-x64.dasc"
+			break;
+		case IR_IN:
+			//|  jmp   >1
+			//|2:
+			//|.cold
+			dasm_put(Dst, 263);
+#line 528 "jit-x64.dasc"
+			//|1:
+			//|  check_fuel
+			dasm_put(Dst, 191);
+			if (sandbox) {
+			dasm_put(Dst, 271, (done));
+			}
+#line 530 "jit-x64.dasc"
+			//|  spill_cells
+			for (int k = 0; k < ncells; k++) {
+				int off = cells[k];
+			switch (k) {
+			case 0:
+			dasm_put(Dst, 279, off);
+			break; case 1:
+			dasm_put(Dst, 284, off);
+			break; case 2:
+			dasm_put(Dst, 289, off);
+			break; case 3:
+			dasm_put(Dst, 294, off);
+			break; case 4:
+			dasm_put(Dst, 299, off);
+			break; case 5:
+			dasm_put(Dst, 304, off);
+			break; case 6:
+			dasm_put(Dst, 290, off);
+			break; default:
+			dasm_put(Dst, 285, off);
+			}
+			}
+#line 531 "jit-x64.dasc"
+			//|  mov   rdi, IN
+			//|  callp getc_unlocked
+			dasm_put(Dst, 368);
+			if (jit_rel_target((void *)getc_unlocked)) {
+			dasm_put(Dst, 318, (ptrdiff_t)(jit_rel_target((void *)getc_unlocked)));
+			} else {
+			dasm_put(Dst, 321, (unsigned int)((uintptr_t)getc_unlocked), (unsigned int)(((uintptr_t)getc_unlocked)>>32));
+			}
+#line 533 "jit-x64.dasc"
+			//|  mov   byte [PTR+pos], al
+			//|  load_cells
+			dasm_put(Dst, 280, pos);
+			for (int k = 0; k < ncells; k++) {
+				int off = cells[k];
+			switch (k) {
+			case 0:
+			dasm_put(Dst, 329, off);
+			break; case 1:
+			dasm_put(Dst, 334, off);
+			break; case 2:
+			dasm_put(Dst, 339, off);
+			break; case 3:
+			dasm_put(Dst, 344, off);
+			break; case 4:
+			dasm_put(Dst, 349, off);
+			break; case 5:
+			dasm_put(Dst, 354, off);
+			break; case 6:
+			dasm_put(Dst, 340, off);
+			break; default:
+			dasm_put(Dst, 335, off);
+			}
+			}
+#line 535 "jit-x64.dasc"
+			//|  jmp   <2
+			//|  back_to_loop
+			dasm_put(Dst, 359);
+			if (outlined >= 0) {
+			dasm_put(Dst, 364);
+			} else {
+			dasm_put(Dst, 366);
+			}
+#line 537 "jit-x64.dasc"
+			break;
+		case IR_OPEN:
+			l = profile_of(guide, op->bracket);
+			if (!sandbox && !entry && op->match == i + 2 &&
+			    prog->ops[i + 1].op == IR_MOVE &&
+			    abs(prog->ops[i + 1].val) == 1 &&
+			    profile_distance(l) >= SCAN_SIMD_MIN) {
+				emit_scan(state, prog->ops[i + 1].val);
+				i = op->match;
+				break;
+			}
+			// Each loop gets five pclabels: the test at its
+			// bottom, its head, the start of its body, a cold
+			// stub that reloads its cells before the test, and
+			// its exit when it is out of line or unrolled.
+			// We store the first in a stack to link the loop
+			// begin and end together.
+			if (stack_push(&pcstack, maxpc)) err("Out of memory.");
+			if (outlined < 0 && profile_cold(l)) {
+				outlined = op->match;
+				if (op->val) {
+					//|  jmp  =>(maxpc+1)
+					dasm_put(Dst, 372, (maxpc+1));
+#line 559 "jit-x64.dasc"
+				} else {
+					//|  cmp  byte [PTR], 0
+					//|  jne  =>(maxpc+1)
+					dasm_put(Dst, 376, (maxpc+1));
+#line 562 "jit-x64.dasc"
+				}
+				//|=>(maxpc+4):
+				//|.outline
+				dasm_put(Dst, 383, (maxpc+4));
+#line 565 "jit-x64.dasc"
+			}
+			last_open = i;
+			ncells = alloc_cells(prog, i, cells);
+			r = profile_trips(l);
+			unroll = unrolled = ncells && !sandbox && r > 1 &&
+			                    r <= UNROLL_MAX ? r - 1 : 0;
+			resume = maxpc+1;
+			r = !entry && ncounted < COUNTERS ? counted_loop(prog, i) : 0;
+			//|=>(maxpc+1):
+			//|  load_cells
+			dasm_put(Dst, 386, (maxpc+1));
+			for (int k = 0; k < ncells; k++) {
+				int off = cells[k];
+			switch (k) {
+			case 0:
+			dasm_put(Dst, 329, off);
+			break; case 1:
+			dasm_put(Dst, 334, off);
+			break; case 2:
+			dasm_put(Dst, 339, off);
+			break; case 3:
+			dasm_put(Dst, 344, off);
+			break; case 4:
+			dasm_put(Dst, 349, off);
+			break; case 5:
+			dasm_put(Dst, 354, off);
+			break; case 6:
+			dasm_put(Dst, 340, off);
+			break; default:
+			dasm_put(Dst, 335, off);
+			}
+			}
+#line 575 "jit-x64.dasc"
+			if (r) {
+				k = ncounted++;
+				counted[k].open = i;
+				counted[k].unread = r & COUNTED_UNREAD;
+				counted[k].pos = 0;
+				// The test at the bottom decrements first.
+				//|  ctrload k
+				if (k) {
+				dasm_put(Dst, 388);
+				} else {
+				dasm_put(Dst, 393);
+				}
+#line 582 "jit-x64.dasc"
+				if (!op->val) {
+					//|  ctrop k, inc
+					if (k) {
+					dasm_put(Dst, 397);
+					} else {
+					dasm_put(Dst, 402);
+					}
+#line 584 "jit-x64.dasc"
+				}
+			}
+			// Constant propagation may prove the entry test passes.
+			if (!op->val) {
+				//|  jmp  =>(maxpc)
+				dasm_put(Dst, 372, (maxpc));
+#line 589 "jit-x64.dasc"
+			}
+			//|.align 16
+			//|=>(maxpc+2):
+			dasm_put(Dst, 406, (maxpc+2));
+#line 592 "jit-x64.dasc"
+			maxpc += 5;
+			break;
+		case IR_CLOSE:
+			if (unroll) {
+				// Leave if done, then compile the body again.
+				unroll--;
+				top = pcstack.items[pcstack.size - 1];
+				//|  regop 0, cmp, 0
+				switch (0) {
+				case 0:
+				dasm_put(Dst, 410);
+				break; case 1:
+				dasm_put(Dst, 416);
+				break; case 2:
+				dasm_put(Dst, 422);
+				break; case 3:
+				dasm_put(Dst, 428);
+				break; case 4:
+				dasm_put(Dst, 434);
+				break; case 5:
+				dasm_put(Dst, 440);
+				break; case 6:
+				dasm_put(Dst, 423);
+				break; default:
+				dasm_put(Dst, 417);
+				}
+#line 600 "jit-x64.dasc"
+				//|  je   =>(top+4)
+				dasm_put(Dst, 446, (top+4));
+#line 601 "jit-x64.dasc"
+				i = op->match;
+				continue;
+			}
+			stack_pop(&pcstack, &top);
+			//|=>(top):
+			dasm_put(Dst, 386, (top));
+#line 606 "jit-x64.dasc"
+			if (sandbox) {
+				//|  sub  FUEL, loop_cost(prog, op->match)
+				dasm_put(Dst, 450, loop_cost(prog, op->match));
+#line 608 "jit-x64.dasc"
+			}
+			if ((flags & COMPILE_CHECKPOINT) && last_open != op->match) {
+				//|  mov64 rax, (uintptr_t)&checkpoint_requested
+				//|  cmp  dword [rax], 0
+				//|  jne  >1
+				//|.cold
+				dasm_put(Dst, 456, (unsigned int)((uintptr_t)&checkpoint_requested), (unsigned int)(((uintptr_t)&checkpoint_requested)>>32));
+#line 614 "jit-x64.dasc"
+				//|1:
+				//|  mov64 rax, (uintptr_t)&checkpoint_at
+				//|  mov  qword [rax], i
+				//|  mov  [rax+8], PTR
+				//|  jmp  =>(done)
+				//|  back_to_loop
+				dasm_put(Dst, 469, (unsigned int)((uintptr_t)&checkpoint_at), (unsigned int)(((uintptr_t)&checkpoint_at)>>32), i, (done));
+				if (outlined >= 0) {
+				dasm_put(Dst, 364);
+				} else {
+				dasm_put(Dst, 366);
+				}
+#line 620 "jit-x64.dasc"
+			}
+			if (ncounted && counted[ncounted-1].open == op->match) {
+				k = --ncounted;
+				//|  ctrop k, dec
+				if (k) {
+				dasm_put(Dst, 487);
+				} else {
+				dasm_put(Dst, 492);
+				}
+#line 624 "jit-x64.dasc"
+				//|  jnz  =>(top+2)
+				dasm_put(Dst, 379, (top+2));
+#line 625 "jit-x64.dasc"
+				if (counted[k].unread) {
+					//|  mov  byte [PTR], 0
+					dasm_put(Dst, 496);
+#line 627 "jit-x64.dasc"
+				}
+			} else if (ncells) {
+				//|  regop 0, cmp, 0
+				switch (0) {
+				case 0:
+				dasm_put(Dst, 410);
+				break; case 1:
+				dasm_put(Dst, 416);
+				break; case 2:
+				dasm_put(Dst, 422);
+				break; case 3:
+				dasm_put(Dst, 428);
+				break; case 4:
+				dasm_put(Dst, 434);
+				break; case 5:
+				dasm_put(Dst, 440);
+				break; case 6:
+				dasm_put(Dst, 423);
+				break; default:
+				dasm_put(Dst, 417);
+				}
+#line 630 "jit-x64.dasc"
+				//|  jne  =>(top+2)
+				dasm_put(Dst, 379, (top+2));
+#line 631 "jit-x64.dasc"
+				if (unrolled) {
+					//|=>(top+4):
+					dasm_put(Dst, 386, (top+4));
+#line 633 "jit-x64.dasc"
+				}
+				//|  spill_cells
+				for (int k = 0; k < ncells; k++) {
+					int off = cells[k];
+				switch (k) {
+				case 0:
+				dasm_put(Dst, 279, off);
+				break; case 1:
+				dasm_put(Dst, 284, off);
+				break; case 2:
+				dasm_put(Dst, 289, off);
+				break; case 3:
+				dasm_put(Dst, 294, off);
+				break; case 4:
+				dasm_put(Dst, 299, off);
+				break; case 5:
+				dasm_put(Dst, 304, off);
+				break; case 6:
+				dasm_put(Dst, 290, off);
+				break; default:
+				dasm_put(Dst, 285, off);
+				}
+				}
+#line 635 "jit-x64.dasc"
+				// Resuming here needs the cells in registers.
+				resume = top+3;
+				//|.cold
+				dasm_put(Dst, 269);
+#line 638 "jit-x64.dasc"
+				//|=>(top+3):
+				//|  load_cells
+				dasm_put(Dst, 386, (top+3));
+				for (int k = 0; k < ncells; k++) {
+					int off = cells[k];
+				switch (k) {
+				case 0:
+				dasm_put(Dst, 329, off);
+				break; case 1:
+				dasm_put(Dst, 334, off);
+				break; case 2:
+				dasm_put(Dst, 339, off);
+				break; case 3:
+				dasm_put(Dst, 344, off);
+				break; case 4:
+				dasm_put(Dst, 349, off);
+				break; case 5:
+				dasm_put(Dst, 354, off);
+				break; case 6:
+				dasm_put(Dst, 340, off);
+				break; default:
+				dasm_put(Dst, 335, off);
+				}
+				}
+#line 640 "jit-x64.dasc"
+				//|  jmp  =>(top)
+				//|  back_to_loop
+				dasm_put(Dst, 372, (top));
+				if (outlined >= 0) {
+				dasm_put(Dst, 364);
+				} else {
+				dasm_put(Dst, 366);
+				}
+#line 642 "jit-x64.dasc"
+			} else {
+				resume = top;
+				//|  cmp  byte [PTR], 0
+				//|  jne  =>(top+2)
+				dasm_put(Dst, 376, (top+2));
+#line 646 "jit-x64.dasc"
+			}
+			if (outlined == i) {
+				//|  jmp  =>(top+4)
+				//|.code
+				dasm_put(Dst, 500, (top+4));
+#line 650 "jit-x64.dasc"
+				outlined = -1;
+			}
+			ncells = pos = unrolled = 0;
+			break;
+		}
+		// Stash it as label + 1 until the code address is known.
+		if (entry)
+			entry[i] = (void *) (intptr_t) (resume + 1);
+	}
+
+	// Function epilogue.
+	//|=>(done):
+	//|  mov  rax, FUEL
+	//|  add  rsp, 8
+	//|  pop  r15
+	//|  pop  rbp
+	//|  pop  FUEL
+	//|  pop  OUT
+	//|  pop  IN
+	//|  pop  PTR
+	//|  ret
+	dasm_put(Dst, 505, (done));
+#line 671 "jit-x64.dasc"
+
+	bf_fn code = jitcode(&state);
+	for (int i = 0; entry && i < prog->len; i++) {
+		int pc = (intptr_t) entry[i] - 1;
+		entry[i] = pc < 0 || code == NULL ? NULL
+		         : (char *) code + dasm_getpclabel(&state, pc);
+	}
+	dasm_free(&state);
+	stack_free(&pcstack);
+	return code;
+}
+
+// Compiles the program in filename.  Returns NULL if the program cannot
+// be read, has unbalanced brackets or cannot be compiled.
+static bf_fn compile(const char * const filename)
+{
+	struct ir_prog prog;
+	FILE *fp = open_source(filename);
+	if (fp == NULL) return NULL;
+	int status = ir_parse(fp, &prog);
+	fclose(fp);
+	if (status) return NULL;
+	ir_propagate(&prog);
+	bf_fn code = compile_ir(&prog, NULL, 0);
+	ir_free(&prog);
+	return code;
+}
+
+// Background compilation: the program starts out in the IR interpreter
+// while a second thread compiles it, and moves over to the compiled code
+// at the first loop test it reaches once the code is ready.
+struct background {
+	const struct ir_prog *prog;
+	void **entry;
+	bf_fn code;
+	int ready;
+};
+
+static void *compile_background(void *arg)
+{
+	struct background *bg = arg;
+	bg->code = compile_ir(bg->prog, bg->entry, 0);
+	__atomic_store_n(&bg->ready, 1, __ATOMIC_RELEASE);
+	return NULL;
+}
+
+static void run_background(const struct ir_prog * const prog,
+                           uint8_t * const tape)
+{
+	// Heap allocated, since the compiler thread is left running if the
+	// program finishes first.
+	struct background *bg = calloc(1, sizeof(*bg));
+	if (bg == NULL) err("Out of memory");
+	bg->prog = prog;
+	bg->entry = calloc(prog->len ? prog->len : 1, sizeof(void *));
+	pthread_t thread;
+	if (bg->entry == NULL ||
+	    pthread_create(&thread, NULL, compile_background, bg))
+		err("Couldn't start compiler thread");
+
+	uint8_t *ptr = tape;
+	int pc = 0;
+	while (pc < prog->len) {
+		// Interpret in chunks until the code is ready, then single
+		// step up to the next loop test and switch there.  If it
+		// could not be compiled, entry stays empty and the whole
+		// program is interpreted.
+		int ready = __atomic_load_n(&bg->ready, __ATOMIC_ACQUIRE);
+		if (ready && bg->entry[pc]) {
+			bg->code(ptr, stdin, stdout, bg->entry[pc], 0);
+			pthread_join(thread, NULL);
+			free_jitcode(bg->code);
+			free(bg->entry);
+			free(bg);
+			return;
+		}
+		long steps = ready && bg->code ? 1 : 4096;
+		pc = ir_eval(prog, pc, tape, 30000, &ptr, stdin, stdout, &steps);
+		if (steps && pc < prog->len) err("Pointer left the tape");
+	}
+}
+
+// Trace code shares one frame layout, so exits can jump from trace to
+// trace.  r15 holds where to store the cell pointer on the way out.
+static trace_fn compile_trace(const struct ir_prog * const prog,
+                              const struct trace_op * const rec,
+                              const int len, void ** const links,
+                              void ** const body)
+{
+	dasm_State *state;
+	initjit(&state, actions);
+	// The body, and the exit that picks where to go next.
+	dasm_growpc(&state, 2);
+	const int start = 0, leave = 1;
+
+	//|  push PTR
+	//|  push IN
+	//|  push OUT
+	//|  push r15
+	//|  sub  rsp, 8        // keep the stack 16 byte aligned for calls
+	//|  mov  r15, rdi
+	//|  mov  PTR, [rdi]
+	//|  mov  IN, rsi
+	//|  mov  OUT, rdx
+	//|.align 16
+	//|=>(start):
+	dasm_put(Dst, 526, (start));
+#line 777 "jit-x64.dasc"
+
+	// Moves fold into the offset pos, applied at exits.
+	int pos = 0;
+	for (int t = 0; t < len; t++) {
+		const struct ir *op = &prog->ops[rec[t].pc];
+		int nonzero, other;
+		switch (op->op) {
+		case IR_MOVE:
+			pos += op->val;
+			break;
+		case IR_ADD:
+			//|  add  byte [PTR+pos], op->val
+			dasm_put(Dst, 229, pos, op->val);
+#line 789 "jit-x64.dasc"
+			break;
+		case IR_SET:
+			//|  mov  byte [PTR+pos], op->val
+			dasm_put(Dst, 258, pos, op->val);
+#line 792 "jit-x64.dasc"
+			break;
+		case IR_OUT:
+			//|  movzx edi, byte [PTR+pos]
+			//|  mov   rsi, OUT
+			//|  callp putc_unlocked
+			dasm_put(Dst, 309, pos);
+			if (jit_rel_target((void *)putc_unlocked)) {
+			dasm_put(Dst, 318, (ptrdiff_t)(jit_rel_target((void *)putc_unlocked)));
+			} else {
+			dasm_put(Dst, 321, (unsigned int)((uintptr_t)putc_unlocked), (unsigned int)(((uintptr_t)putc_unlocked)>>32));
+			}
+#line 797 "jit-x64.dasc"
+			break;
+		case IR_IN:
+			//|  mov   rdi, IN
+			//|  callp getc_unlocked
+			dasm_put(Dst, 368);
+			if (jit_rel_target((void *)getc_unlocked)) {
+			dasm_put(Dst, 318, (ptrdiff_t)(jit_rel_target((void *)getc_unlocked)));
+			} else {
+			dasm_put(Dst, 321, (unsigned int)((uintptr_t)getc_unlocked), (unsigned int)(((uintptr_t)getc_unlocked)>>32));
+			}
+#line 801 "jit-x64.dasc"
+			//|  mov   byte [PTR+pos], al
+			dasm_put(Dst, 280, pos);
+#line 802 "jit-x64.dasc"
+			break;
+		case IR_OPEN:
+		case IR_CLOSE:
+			// Guard the way the test went while recording; the
+			// other way leaves the trace.
+			if (op->op == IR_OPEN) {
+				// Constant propagation may prove the test.
+				if (op->val) break;
+				nonzero = rec[t].next == rec[t].pc + 1;
+				other = nonzero ? op->match + 1 : rec[t].pc + 1;
+			} else {
+				nonzero = rec[t].next == op->match + 1;
+				other = nonzero ? rec[t].pc + 1 : op->match + 1;
+			}
+			//|  cmp  byte [PTR+pos], 0
+			dasm_put(Dst, 556, pos);
+#line 817 "jit-x64.dasc"
+			if (nonzero) {
+				//|  je   >1
+				dasm_put(Dst, 561);
+#line 819 "jit-x64.dasc"
+			} else {
+				//|  jne  >1
+				dasm_put(Dst, 566);
+#line 821 "jit-x64.dasc"
+			}
+			//|.cold
+			dasm_put(Dst, 269);
+#line 823 "jit-x64.dasc"
+			//|1:
+			dasm_put(Dst, 191);
+#line 824 "jit-x64.dasc"
+			if (pos) {
+				//|  add  PTR, pos
+				dasm_put(Dst, 194, pos);
+#line 826 "jit-x64.dasc"
+			}
+			// Link straight to a trace compiled earlier.
+			if (links[other]) {
+				//|  jmpp links[other]
+				if (jit_rel_target(links[other])) {
+				dasm_put(Dst, 571, (ptrdiff_t)(jit_rel_target(links[other])));
+				} else {
+				dasm_put(Dst, 575, (unsigned int)((uintptr_t)links[other]), (unsigned int)(((uintptr_t)links[other])>>32));
+				}
+#line 830 "jit-x64.dasc"
+			} else {
+				//|  mov  eax, other
+				//|  jmp  =>(leave)
+				dasm_put(Dst, 583, other, (leave));
+#line 833 "jit-x64.dasc"
+			}
+			//|.code
+			dasm_put(Dst, 366);
+#line 835 "jit-x64.dasc"
+			break;
+		}
+	}
+	if (pos) {
+		//|  add  PTR, pos
+		dasm_put(Dst, 194, pos);
+#line 840 "jit-x64.dasc"
+	}
+	if (rec[len - 1].next == rec[0].pc) {
+		//|  jmp  =>(start)
+		dasm_put(Dst, 372, (start));
+#line 843 "jit-x64.dasc"
+	} else if (links[rec[len - 1].next]) {
+		//|  jmpp links[rec[len - 1].next]
+		if (jit_rel_target(links[rec[len - 1].next])) {
+		dasm_put(Dst, 571, (ptrdiff_t)(jit_rel_target(links[rec[len - 1].next])));
+		} else {
+		dasm_put(Dst, 575, (unsigned int)((uintptr_t)links[rec[len - 1].next]), (unsigned int)(((uintptr_t)links[rec[len - 1].next])>>32));
+		}
+#line 845 "jit-x64.dasc"
+	} else {
+		//|  mov  eax, rec[len - 1].next
+		dasm_put(Dst, 589, rec[len - 1].next);
+#line 847 "jit-x64.dasc"
+	}
+
+	// eax holds the pc to go on with.
+	//|=>(leave):
+	//|  mov64 rcx, (uintptr_t)links
+	//|  mov  rdx, [rcx+rax*8]
+	//|  test rdx, rdx
+	//|  jz   >1
+	//|  jmp  rdx
+	//|1:
+	//|  mov  [r15], PTR
+	//|  add  rsp, 8
+	//|  pop  r15
+	//|  pop  OUT
+	//|  pop  IN
+	//|  pop  PTR
+	//|  ret
+	dasm_put(Dst, 592, (leave), (unsigned int)((uintptr_t)links), (unsigned int)(((uintptr_t)links)>>32));
+#line 864 "jit-x64.dasc"
+
+	trace_fn code = jitcode(&state);
+	*body = code ? (char *) code + dasm_getpclabel(&state, start) : NULL;
+	dasm_free(&state);
+	return code;
+}
+
+// Parses and optimizes the program in filename, or exits.
+static void load_program(const char * const filename,
+                         struct ir_prog * const prog)
+{
+	FILE *fp = open_source(filename);
+	if (fp == NULL) err("Couldn't open file");
+	if (ir_parse(fp, prog)) err("Unmatched brackets");
+	fclose(fp);
+	ir_propagate(prog);
+}
+
+// Compiles prog for the sandbox.  Returns NULL and sets *why if it
+// can't.
+static bf_fn compile_sandboxed(const struct ir_prog * const prog,
+                               const char ** const why)
+{
+	if (access_reach(prog) >= SANDBOX_GUARD) {
+		*why = "Pointer moves too far for the sandbox";
+		return NULL;
+	}
+	*why = "Couldn't compile program";
+	return compile_ir(prog, NULL, COMPILE_SANDBOX);
+}
+
+// Runs the program in filename in the sandbox.  Returns its status.
+static int run_sandboxed(const char * const filename, const long fuel)
+{
+	struct ir_prog prog;
+	const char *why;
+	load_program(filename, &prog);
+	bf_fn code = compile_sandboxed(&prog, &why);
+	ir_free(&prog);
+	if (code == NULL) err(why);
+
+	int status = sandbox_run(code, stdin, stdout, fuel);
+	free_jitcode(code);
+	fflush(stdout);
+	if (status == BF_OUT_OF_FUEL)
+		fprintf(stderr, "Out of fuel\n");
+	else if (status == BF_OUT_OF_BOUNDS)
+		fprintf(stderr, "Pointer left the tape\n");
+	return status;
+}
+
+// Checkpointed code reads and writes through stdio without counting, so
+// it gets streams over stdin and stdout that count for it: ftell() on
+// them gives the input consumed and the output written.  They start out
+// positioned for resuming from c, as checkpoint_resume_io() does.
+struct checkpoint_stream {
+	int fd;
+	long count; // bytes moved through the file descriptor
+};
+
+static ssize_t checkpoint_read(void *cookie, char *buf, size_t size)
+{
+	struct checkpoint_stream *s = cookie;
+	ssize_t n;
+	while ((n = read(s->fd, buf, size)) < 0 && errno == EINTR)
+		;
+	if (n > 0) s->count += n;
+	return n < 0 ? -1 : n;
+}
+
+static ssize_t checkpoint_write(void *cookie, const char *buf, size_t size)
+{
+	struct checkpoint_stream *s = cookie;
+	size_t done = 0;
+	while (done < size) {
+		ssize_t n = write(s->fd, buf + done, size - done);
+		if (n < 0 && errno == EINTR) continue;
+		if (n <= 0) break;
+		done += n;
+	}
+	s->count += done;
+	return done;
+}
+
+// Only reports the position; stdio asks for it to implement ftell().
+static int checkpoint_seek(void *cookie, off64_t *offset, int whence)
+{
+	struct checkpoint_stream *s = cookie;
+	if (whence != SEEK_CUR || *offset != 0) return -1;
+	*offset = s->count;
+	return 0;
+}
+
+static inline
+void checkpoint_streams(const struct checkpoint * const c, FILE **in,
+                        FILE **out)
+{
+	static struct checkpoint_stream streams[2];
+	cookie_io_functions_t io = { .read = checkpoint_read,
+	                             .write = checkpoint_write,
+	                             .seek = checkpoint_seek };
+
+	fflush(stdout);
+	streams[0].fd = STDIN_FILENO;
+	streams[1].fd = STDOUT_FILENO;
+	*in = fopencookie(&streams[0], "r", io);
+	*out = fopencookie(&streams[1], "w", io);
+	if (*in == NULL || *out == NULL) err("Out of memory");
+
+	if (c->in && lseek(STDIN_FILENO, c->in, SEEK_SET) == c->in) {
+		streams[0].count = c->in;
+	} else {
+		for (long i = 0; i < c->in; i++)
+			if (getc(*in) == EOF) break;
+	}
+	struct stat st;
+	streams[1].count = c->out;
+	if (c->out && !fstat(STDOUT_FILENO, &st) && S_ISREG(st.st_mode) &&
+	    st.st_size >= c->out) {
+		if (ftruncate(STDOUT_FILENO, c->out) ||
+		    lseek(STDOUT_FILENO, c->out, SEEK_SET) < 0)
+			err("Couldn't truncate output");
+	}
+}
+
+// Runs the program in filename, saving checkpoints to checkpoint_file if
+// it is not NULL, and starting from the one in resume_file if that is
+// not NULL.  See checkpoint.h.
+static void run_checkpointed(const char * const filename,
+                             const char * const checkpoint_file,
+                             const char * const resume_file)
+{
+	static struct checkpoint state = { .tool = "jit-x64" };
+	char *source = read_file(filename);
+	if (source == NULL) err("Couldn't open file");
+	state.program = hash_bytes(source, strlen(source));
+	free(source);
+
+	struct ir_prog prog;
+	load_program(filename, &prog);
+	void **entry = calloc(prog.len ? prog.len : 1, sizeof(void *));
+	if (entry == NULL) err("Out of memory");
+	bf_fn code = compile_ir(&prog, entry,
+	                        checkpoint_file ? COMPILE_CHECKPOINT : 0);
+	if (code == NULL) err("Couldn't compile file");
+
+	void *resume = NULL;
+	if (resume_file) {
+		checkpoint_load(resume_file, state.tool, state.program, &state);
+		if (state.pc < 0 || state.pc >= prog.len ||
+		    prog.ops[state.pc].op != IR_CLOSE)
+			err("Corrupt checkpoint");
+		resume = entry[state.pc];
+	}
+	FILE *in, *out;
+	checkpoint_streams(&state, &in, &out);
+	if (checkpoint_file) checkpoint_signals();
+
+	uint8_t *ptr = state.tape + state.ptr;
+	for (;;) {
+		checkpoint_at.pc = -1;
+		code(ptr, in, out, resume, 0);
+		if (checkpoint_at.pc < 0) break;
+
+		const int stop = checkpoint_requested == CHECKPOINT_STOP;
+		checkpoint_requested = CHECKPOINT_NONE;
+		fflush(out);
+		state.pc = checkpoint_at.pc;
+		state.ptr = checkpoint_at.ptr - state.tape;
+		state.in = ftell(in);
+		state.out = ftell(out);
+		checkpoint_save(checkpoint_file, &state);
+		if (stop) exit(CHECKPOINT_EXIT);
+		ptr = checkpoint_at.ptr;
+		resume = entry[state.pc];
+	}
+	if (fclose(out)) err("Couldn't write output");
+	fclose(in);
+	free(entry);
+	ir_free(&prog);
+	free_jitcode(code);
+}
+
+// Fork server: compiles the program once, then reads requests from stdin,
+// one "input output" pair of file names per line.  Each runs in a forked
+// child, which inherits the encoded code and a zeroed tape, so a run
+// costs no parsing, encoding or mapping.  Prints one line per request
+// with the child's exit status, or 128 plus the signal that killed it.
+static void run_forkserver(const char * const filename)
+{
+	bf_fn code = compile(filename);
+	if (code == NULL) err("Couldn't compile file");
+	uint8_t *tape = calloc(30000, 1);
+	if (tape == NULL) err("Out of memory");
+
+	char *line = NULL, *input, *output;
+	size_t line_size = 0;
+	while (getline(&line, &line_size, stdin) != -1) {
+		int n = sscanf(line, "%ms %ms", &input, &output);
+		if (n <= 0) continue;
+		if (n != 2) err("Requests need: input output");
+		fflush(stdout);
+		pid_t pid = fork();
+		if (pid < 0) err("Couldn't fork");
+		if (pid == 0) {
+			FILE *in = fopen(input, "rb");
+			FILE *out = fopen(output, "wb");
+			if (in == NULL || out == NULL) _exit(1);
+			code(tape, in, out, NULL, 0);
+			_exit(fclose(out) ? 1 : 0);
+		}
+		free(input);
+		free(output);
+
+		int status;
+		if (waitpid(pid, &status, 0) < 0) err("waitpid failed");
+		printf("%d\n", WIFEXITED(status) ? WEXITSTATUS(status)
+		                                 : 128 + WTERMSIG(status));
+		fflush(stdout);
+	}
+	free(line);
+	free(tape);
+	free_jitcode(code);
+}
+
+int main(int argc, char *argv[])
+{
+	const char * const usage =
+	    "Usage: jit-x64 [-a | -f | -s <fuel> | -t] [-g <profile>] "
+	    "<inputfile>\n"
+	    "       jit-x64 [-c <checkpoint>] [-r <checkpoint>] <inputfile>\n"
+	    "       jit-x64 -b <manifest> [-j <threads>]\n"
+	    "       jit-x64 -d <socket> [-j <threads>] [-s <fuel>]";
+	const char *manifest = NULL, *daemon_socket = NULL;
+	const char *checkpoint_file = NULL, *resume_file = NULL;
+	const char *profile_file = NULL;
+	int opt, background = 0, forkserver = 0, trace = 0;
+	int threads = sysconf(_SC_NPROCESSORS_ONLN);
+	long fuel = -1;
+	while ((opt = getopt(argc, argv, "ab:c:d:fg:j:r:s:t")) != -1) {
+		switch (opt) {
+		case 'a': background = 1; break;
+		case 'b': manifest = optarg; break;
+		case 'c': checkpoint_file = optarg; break;
+		case 'd': daemon_socket = optarg; break;
+		case 'f': forkserver = 1; break;
+		case 'g': profile_file = optarg; break;
+		case 'j': threads = atoi(optarg); break;
+		case 'r': resume_file = optarg; break;
+		case 's': fuel = atol(optarg); break;
+		case 't': trace = 1; break;
+		default: err(usage);
+		}
+	}
+	if (threads < 1) threads = 1;
+	// Workers compile side by side; keep them off /tmp/jitcode.
+	jitcode_dump = !manifest && !daemon_socket;
+	if (manifest)
+		return batch_run(manifest, threads) ? 1 : 0;
+	if (daemon_socket)
+		served_run(daemon_socket, threads, fuel);
+	if (optind >= argc || background + forkserver + trace + (fuel >= 0) +
+	    (checkpoint_file || resume_file) > 1)
+		err(usage);
+
+	if (profile_file) {
+		static struct profile prof;
+		char *source = read_file(argv[optind]);
+		if (source == NULL) err("Couldn't open file");
+		profile_load(profile_file, hash_bytes(source, strlen(source)),
+		             &prof);
+		free(source);
+		guide = &prof;
+	}
+	if (fuel >= 0)
+		return run_sandboxed(argv[optind], fuel);
+	if (forkserver) {
+		run_forkserver(argv[optind]);
+		return 0;
+	}
+	if (checkpoint_file || resume_file) {
+		run_checkpointed(argv[optind], checkpoint_file, resume_file);
+		return 0;
+	}
+
+	if (background || trace) {
+		struct ir_prog prog;
+		load_program(argv[optind], &prog);
+		if (trace)
+			trace_run(&prog, calloc(30000, 1));
+		else
+			run_background(&prog, calloc(30000, 1));
+		return 0;
+	}
+
+	bf_fn fptr = compile(argv[optind]);
+	if (fptr == NULL) err("Couldn't compile file");
+	uint8_t *mem = calloc(30000, 1);
+	fptr(mem, stdin, stdout, NULL, 0);
+	free(mem);
+	free_jitcode(fptr);
+	return 0;
+}
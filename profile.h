@@ -0,0 +1,143 @@
+// Loop profiles: how each loop behaved on a run of the interpreter (-p),
+// to guide the next compile by jit-x64 and compiler-x64 (-g).
+//
+// Loops are identified by the ordinal of their '[' in the source, which
+// the IR keeps through its optimizations.  For each loop the profile
+// counts how often its '[' test ran and failed, and how many times its
+// body ran per test, as a histogram of trip counts.
+//
+// Uses err() from util.h.
+//
+// The file is a line of header followed by a line per loop:
+//   bf-profile <program hash> <loops>
+//   <tests> <skipped> <iterations> <min trips> <max trips> <histogram>
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+// Trip count buckets: 0, 1, 2-3, 4-7, ..., and 1024 or more.
+#define PROFILE_BUCKETS 12
+
+struct profile_loop {
+	long tests;      // times its '[' test ran
+	long skipped;    // times the test failed
+	long iterations; // times its body ran
+	long min, max;   // fewest and most trips, once tested
+	long hist[PROFILE_BUCKETS];
+};
+
+struct profile {
+	uint64_t program; // hash of the program source
+	int loops;
+	struct profile_loop *loop;
+};
+
+// Sets p up for loops loops, with nothing recorded.
+static inline
+void profile_init(struct profile * const p, const uint64_t program,
+                  const int loops)
+{
+	p->program = program;
+	p->loops = loops;
+	p->loop = calloc(loops ? loops : 1, sizeof(*p->loop));
+	if (p->loop == NULL) err("Out of memory");
+}
+
+static inline
+void profile_free(struct profile * const p)
+{
+	free(p->loop);
+	p->loop = NULL;
+	p->loops = 0;
+}
+
+// Records a run of loop l: its test, and the trips its body made.
+static inline
+void profile_record(struct profile_loop * const l, const long trips)
+{
+	int bucket = 0;
+	while (bucket < PROFILE_BUCKETS - 1 && trips >> bucket)
+		bucket++;
+	if (!l->tests || trips < l->min) l->min = trips;
+	if (!l->tests || trips > l->max) l->max = trips;
+	l->tests++;
+	l->skipped += !trips;
+	l->iterations += trips;
+	l->hist[bucket]++;
+}
+
+static inline
+void profile_save(const char * const filename, const struct profile * const p)
+{
+	FILE *fp = fopen(filename, "w");
+	if (fp == NULL) err("Couldn't write profile");
+	fprintf(fp, "bf-profile %016llx %d\n", (unsigned long long) p->program,
+	        p->loops);
+	for (int i = 0; i < p->loops; i++) {
+		const struct profile_loop *l = &p->loop[i];
+		fprintf(fp, "%ld %ld %ld %ld %ld", l->tests, l->skipped,
+		        l->iterations, l->min, l->max);
+		for (int b = 0; b < PROFILE_BUCKETS; b++)
+			fprintf(fp, " %ld", l->hist[b]);
+		putc('\n', fp);
+	}
+	if (fclose(fp)) err("Couldn't write profile");
+}
+
+// Reads the profile in filename into p, checking it was taken of the
+// program with the given hash.
+static inline
+void profile_load(const char * const filename, const uint64_t program,
+                  struct profile * const p)
+{
+	FILE *fp = fopen(filename, "r");
+	if (fp == NULL) err("Couldn't read profile");
+	unsigned long long hash;
+	int loops;
+	if (fscanf(fp, "bf-profile %llx %d", &hash, &loops) != 2 || loops < 0)
+		err("Not a profile");
+	if (hash != program)
+		err("Profile is for another program");
+	profile_init(p, program, loops);
+	for (int i = 0; i < loops; i++) {
+		struct profile_loop *l = &p->loop[i];
+		int n = fscanf(fp, "%ld %ld %ld %ld %ld", &l->tests, &l->skipped,
+		               &l->iterations, &l->min, &l->max);
+		for (int b = 0; b < PROFILE_BUCKETS && n == 5; b++)
+			if (fscanf(fp, "%ld", &l->hist[b]) != 1) n = 0;
+		if (n != 5) err("Corrupt profile");
+	}
+	fclose(fp);
+}
+
+// The profile of the loop with the given '[' ordinal, or NULL.
+static inline
+const struct profile_loop *profile_of(const struct profile * const p,
+                                      const int bracket)
+{
+	if (p == NULL || bracket >= p->loops) return NULL;
+	return &p->loop[bracket];
+}
+
+// Whether the loop never ran its body, and is best kept out of the way.
+static inline
+int profile_cold(const struct profile_loop * const l)
+{
+	return l && l->iterations == 0;
+}
+
+// The trips the loop made every time it was tested, or -1 if they varied.
+static inline
+long profile_trips(const struct profile_loop * const l)
+{
+	return l && l->tests && l->min == l->max ? l->max : -1;
+}
+
+// The average trips of the loop when its body ran at all, or 0.
+static inline
+long profile_distance(const struct profile_loop * const l)
+{
+	return l && l->tests > l->skipped
+	     ? l->iterations / (l->tests - l->skipped) : 0;
+}
@@ -0,0 +1,113 @@
+// Sandbox mode: runs untrusted programs with a step budget and a fenced
+// tape, without checks on the hot path.
+//
+// Sandboxed code keeps its fuel in r14 and subtracts each loop's cost at
+// its back-edge, but never tests it.  Instead a CPU time timer fires every
+// SANDBOX_TICK microseconds, and if it interrupts the generated code with
+// the fuel gone negative, unwinds back to sandbox_run().  Code that ends
+// in between is caught by the fuel it returns.  A program can thus run
+// at most one tick past its budget.
+//
+// The tape sits between large PROT_NONE guard regions, so instead of
+// checking the pointer, a stray access faults and the fault handler
+// unwinds the same way.  The tape is rounded up to whole pages and placed
+// against the upper guard: running off its end is caught exactly, while
+// running off its start may touch up to a page of slack first.  Either
+// way the program can only ever reach its own tape.
+
+#include <setjmp.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <sys/mman.h>
+#include <sys/time.h>
+#include <ucontext.h>
+#include <unistd.h>
+
+// Status of a sandboxed run, used as the exit code.  1 is taken by err().
+enum bf_status {
+	BF_OK = 0,
+	BF_OUT_OF_FUEL = 2,
+	BF_OUT_OF_BOUNDS = 3,
+};
+
+#define SANDBOX_TAPE 30000
+// Size of each guard region.  Programs whose accesses can land further
+// than this from the previous one are refused.
+#define SANDBOX_GUARD (1L << 20)
+#define SANDBOX_TICK 1000
+
+static sigjmp_buf sandbox_escape;
+static const char *sandbox_lo, *sandbox_hi;
+static const char *sandbox_code, *sandbox_code_end;
+
+static void sandbox_fault(int sig, siginfo_t *info, void *context)
+{
+	const char *addr = info->si_addr;
+	(void) context;
+	if (addr >= sandbox_lo && addr < sandbox_hi)
+		siglongjmp(sandbox_escape, BF_OUT_OF_BOUNDS);
+	// Not ours: let the fault happen again without us.
+	signal(sig, SIG_DFL);
+}
+
+static void sandbox_tick(int sig, siginfo_t *info, void *context)
+{
+	const greg_t *regs = ((ucontext_t *) context)->uc_mcontext.gregs;
+	const char *pc = (const char *) regs[REG_RIP];
+	(void) sig;
+	(void) info;
+	// Only unwind out of the generated code itself, never out of the
+	// C library in the middle of I/O.
+	if (pc >= sandbox_code && pc < sandbox_code_end && regs[REG_R14] < 0)
+		siglongjmp(sandbox_escape, BF_OUT_OF_FUEL);
+}
+
+// Runs code on a guarded tape with the given fuel, reading from in and
+// writing to out.  Returns its status.
+static int sandbox_run(const bf_fn code, FILE * const in, FILE * const out,
+                       const long fuel)
+{
+	const size_t page = sysconf(_SC_PAGESIZE);
+	const size_t tape_size = (SANDBOX_TAPE + page - 1) & ~(page - 1);
+	const size_t size = tape_size + 2 * SANDBOX_GUARD;
+
+	char *base = mmap(NULL, size, PROT_NONE,
+	                  MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+	if (base == MAP_FAILED ||
+	    mprotect(base + SANDBOX_GUARD, tape_size, PROT_READ | PROT_WRITE))
+		err("Couldn't map the sandbox tape");
+	uint8_t *tape = (uint8_t *) base + SANDBOX_GUARD + tape_size
+	              - SANDBOX_TAPE;
+	sandbox_lo = base;
+	sandbox_hi = base + size;
+	sandbox_code = (const char *) code;
+	sandbox_code_end = sandbox_code + jitcode_size(code);
+
+	struct sigaction fault = { .sa_flags = SA_SIGINFO }, saved_fault;
+	struct sigaction tick = { .sa_flags = SA_SIGINFO | SA_RESTART };
+	struct sigaction saved_tick;
+	fault.sa_sigaction = sandbox_fault;
+	tick.sa_sigaction = sandbox_tick;
+	sigemptyset(&fault.sa_mask);
+	sigemptyset(&tick.sa_mask);
+	struct itimerval timer = {
+		.it_interval = { .tv_usec = SANDBOX_TICK },
+		.it_value = { .tv_usec = SANDBOX_TICK },
+	}, stopped = { { 0, 0 }, { 0, 0 } };
+	if (sigaction(SIGSEGV, &fault, &saved_fault) ||
+	    sigaction(SIGVTALRM, &tick, &saved_tick) ||
+	    setitimer(ITIMER_VIRTUAL, &timer, NULL))
+		err("Couldn't set up the sandbox");
+
+	int status = sigsetjmp(sandbox_escape, 1);
+	if (status == 0)
+		status = code(tape, in, out, NULL, fuel) < 0
+		       ? BF_OUT_OF_FUEL : BF_OK;
+
+	setitimer(ITIMER_VIRTUAL, &stopped, NULL);
+	sigaction(SIGVTALRM, &saved_tick, NULL);
+	sigaction(SIGSEGV, &saved_fault, NULL);
+	munmap(base, size);
+	return status;
+}
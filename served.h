@@ -0,0 +1,318 @@
+// Daemon mode (bf-served): serves programs over a Unix domain socket so
+// short jobs skip process startup, and repeated programs skip compiling.
+//
+// A client connects, sends the length of the program source in decimal
+// and a newline, then the source, then the program's input until it shuts
+// down its side of the connection.  The daemon answers with the program's
+// output in chunks, each '+' followed by its length in decimal, a newline
+// and that many bytes.  The reply ends with '.' when the program finished,
+// or with '-' followed by an error message and a newline, and the daemon
+// closes the connection.  bf-client.c is the client.
+//
+// Connections are handled by a pool of worker threads.  Compiled programs
+// are kept in an LRU cache keyed by a hash of their source.  The programs
+// are untrusted, so each job runs in a forked child, in the sandbox of
+// sandbox.h with a fuel budget: a job that crashes, loops or runs off its
+// tape only takes down its child, and gets an error reply.
+//
+// The including JIT provides compile_sandboxed().
+
+#include <errno.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+// Compiled programs kept around once no job is running them.
+#define SERVED_CACHE 64
+// Longest program source accepted.
+#define SERVED_MAX_SOURCE (64 << 20)
+// Fuel each job gets unless -s says otherwise; the sample programs need
+// well under a tenth of it.
+#define SERVED_FUEL (1L << 36)
+
+static bf_fn compile_sandboxed(const struct ir_prog * const prog,
+                               const char ** const why);
+
+struct served_program {
+	uint64_t hash;
+	char *source;
+	size_t len;
+	bf_fn code;
+	int users; // jobs running it; it is only freed at 0
+	struct served_program *prev, *next; // most recently used first
+};
+
+struct served {
+	int listener;
+	long fuel;
+	struct served_program *head, *tail;
+	int cached;
+	pthread_mutex_t lock;
+};
+
+static void served_unlink(struct served * const s,
+                          struct served_program * const p)
+{
+	*(p->prev ? &p->prev->next : &s->head) = p->next;
+	*(p->next ? &p->next->prev : &s->tail) = p->prev;
+	s->cached--;
+}
+
+static void served_push(struct served * const s,
+                        struct served_program * const p)
+{
+	p->prev = NULL;
+	p->next = s->head;
+	*(s->head ? &s->head->prev : &s->tail) = p;
+	s->head = p;
+	s->cached++;
+}
+
+// Drops least recently used programs nobody is running until the cache
+// is back within SERVED_CACHE.  Called with the lock held.
+static void served_evict(struct served * const s)
+{
+	struct served_program *p = s->tail;
+	while (s->cached > SERVED_CACHE && p) {
+		struct served_program *prev = p->prev;
+		if (!p->users) {
+			served_unlink(s, p);
+			free_jitcode(p->code);
+			free(p->source);
+			free(p);
+		}
+		p = prev;
+	}
+}
+
+// Returns the compiled program for source, compiling it on a miss, with
+// a use held on it.  Returns NULL and sets *why if it does not compile.
+static struct served_program *served_acquire(struct served * const s,
+                                             char * const source,
+                                             const size_t len,
+                                             const char ** const why)
+{
+	const uint64_t hash = hash_bytes(source, len);
+	struct served_program *p;
+
+	pthread_mutex_lock(&s->lock);
+	for (p = s->head; p; p = p->next)
+		if (p->hash == hash && p->len == len &&
+		    !memcmp(p->source, source, len))
+			break;
+	if (p) {
+		served_unlink(s, p);
+		served_push(s, p);
+		p->users++;
+		pthread_mutex_unlock(&s->lock);
+		free(source);
+		return p;
+	}
+	pthread_mutex_unlock(&s->lock);
+
+	// Compile outside the lock.  Two workers may race to compile the
+	// same program; both copies are cached and the older one ages out.
+	struct ir_prog prog;
+	FILE *fp = fmemopen(source, len, "r");
+	if (fp == NULL) err("Out of memory");
+	int status = ir_parse(fp, &prog);
+	fclose(fp);
+	*why = "Couldn't compile program";
+	if (status) {
+		free(source);
+		return NULL;
+	}
+	ir_propagate(&prog);
+	bf_fn code = compile_sandboxed(&prog, why);
+	ir_free(&prog);
+	if (code == NULL) {
+		free(source);
+		return NULL;
+	}
+
+	p = calloc(1, sizeof(*p));
+	if (p == NULL) err("Out of memory");
+	p->hash = hash;
+	p->source = source;
+	p->len = len;
+	p->code = code;
+	p->users = 1;
+	pthread_mutex_lock(&s->lock);
+	served_push(s, p);
+	served_evict(s);
+	pthread_mutex_unlock(&s->lock);
+	return p;
+}
+
+static void served_release(struct served * const s,
+                           struct served_program * const p)
+{
+	pthread_mutex_lock(&s->lock);
+	p->users--;
+	served_evict(s);
+	pthread_mutex_unlock(&s->lock);
+}
+
+// Sends all of buf to fd.  Returns 0, or -1 if the client is gone.
+static int served_send(const int fd, const char *buf, size_t len)
+{
+	while (len) {
+		ssize_t n = write(fd, buf, len);
+		if (n < 0 && errno == EINTR) continue;
+		if (n <= 0) return -1;
+		buf += n;
+		len -= n;
+	}
+	return 0;
+}
+
+// The program's output stream sends each buffer it flushes as a chunk.
+// Its input stream flushes the output before every read, so prompts reach
+// the client before the program waits for an answer.
+struct served_conn {
+	int fd;
+	FILE *out;
+};
+
+static ssize_t served_write(void *cookie, const char *buf, size_t size)
+{
+	struct served_conn *c = cookie;
+	char header[32];
+	int n = snprintf(header, sizeof(header), "+%zu\n", size);
+	if (served_send(c->fd, header, n) || served_send(c->fd, buf, size))
+		return 0;
+	return size;
+}
+
+static ssize_t served_read(void *cookie, char *buf, size_t size)
+{
+	struct served_conn *c = cookie;
+	fflush(c->out);
+	ssize_t n;
+	while ((n = read(c->fd, buf, size)) < 0 && errno == EINTR)
+		;
+	return n < 0 ? -1 : n;
+}
+
+// Runs p in a child on the rest of the connection.  Returns NULL if it
+// finished, or else what went wrong.
+static const char *served_fork(struct served * const s,
+                               struct served_program * const p,
+                               struct served_conn * const conn,
+                               FILE * const in)
+{
+	pid_t pid = fork();
+	if (pid < 0) return "Couldn't start program";
+	if (pid == 0) {
+		// Leave the other workers' connections to them, or their
+		// clients would not see them close until this job ends.
+		close_range(3, conn->fd - 1, 0);
+		close_range(conn->fd + 1, ~0U, 0);
+		int status = sandbox_run(p->code, in, conn->out, s->fuel);
+		fflush(conn->out);
+		_exit(status);
+	}
+
+	int status;
+	while (waitpid(pid, &status, 0) < 0)
+		if (errno != EINTR) return "Lost program";
+	if (!WIFEXITED(status)) return "Program crashed";
+	switch (WEXITSTATUS(status)) {
+	case BF_OK: return NULL;
+	case BF_OUT_OF_FUEL: return "Out of fuel";
+	case BF_OUT_OF_BOUNDS: return "Pointer left the tape";
+	default: return "Couldn't run program";
+	}
+}
+
+static void served_job(struct served * const s, const int fd)
+{
+	struct served_conn conn = { .fd = fd };
+	cookie_io_functions_t out_io = { .write = served_write };
+	cookie_io_functions_t in_io = { .read = served_read };
+
+	conn.out = fopencookie(&conn, "w", out_io);
+	FILE *in = fopencookie(&conn, "r", in_io);
+	if (conn.out == NULL || in == NULL) err("Out of memory");
+
+	size_t len;
+	char *source = NULL;
+	const char *why;
+	if (fscanf(in, "%zu", &len) != 1 || getc(in) != '\n' ||
+	    len > SERVED_MAX_SOURCE || (source = malloc(len + 1)) == NULL ||
+	    fread(source, 1, len, in) != len) {
+		why = "Bad request";
+		free(source);
+	} else {
+		struct served_program *p = served_acquire(s, source, len, &why);
+		if (p != NULL) {
+			// Any input read ahead with the request is still in
+			// in's buffer, which the child gets a copy of.
+			why = served_fork(s, p, &conn, in);
+			served_release(s, p);
+		}
+	}
+	if (why == NULL) {
+		served_send(fd, ".", 1);
+	} else {
+		char reply[64];
+		served_send(fd, reply, snprintf(reply, sizeof(reply), "-%s\n",
+		                                why));
+	}
+	fclose(in);
+	fclose(conn.out);
+	close(fd);
+}
+
+static void *served_worker(void *arg)
+{
+	struct served *s = arg;
+	for (;;) {
+		int fd = accept(s->listener, NULL, NULL);
+		if (fd >= 0) {
+			served_job(s, fd);
+		} else if (errno != EINTR && errno != ECONNABORTED) {
+			// Likely out of descriptors or memory for now; the
+			// jobs running will give some back.
+			perror("accept failed");
+			sleep(1);
+		}
+	}
+	return NULL;
+}
+
+// Listens on the Unix domain socket at path and serves requests on
+// num_threads workers, giving each job fuel, or SERVED_FUEL if negative.
+// Does not return.
+static void served_run(const char * const path, const int num_threads,
+                       const long fuel)
+{
+	static struct served s = { .lock = PTHREAD_MUTEX_INITIALIZER };
+	struct sockaddr_un addr = { .sun_family = AF_UNIX };
+
+	if (strlen(path) >= sizeof(addr.sun_path)) err("Socket path too long");
+	strcpy(addr.sun_path, path);
+	s.fuel = fuel < 0 ? SERVED_FUEL : fuel;
+	s.listener = socket(AF_UNIX, SOCK_STREAM, 0);
+	unlink(path);
+	if (s.listener < 0 ||
+	    bind(s.listener, (struct sockaddr *) &addr, sizeof(addr)) ||
+	    listen(s.listener, 64))
+		err("Couldn't listen on socket");
+	// Clients that hang up early must not take the daemon down.
+	signal(SIGPIPE, SIG_IGN);
+
+	for (int i = 1; i < num_threads; i++) {
+		pthread_t thread;
+		if (pthread_create(&thread, NULL, served_worker, &s))
+			err("Couldn't create worker thread");
+	}
+	served_worker(&s);
+}
@@ -6,11 +6,46 @@ import sys
 import os
 import time
 
+# Hardware counters are collected through the perfstat helper when it has
+# been built (make perfstat); set BF_PERF to point at it elsewhere.
+perfstat = os.getenv('BF_PERF', './perfstat')
+if not os.access(perfstat, os.X_OK):
+    perfstat = None
+
 def get_output(program, stdin):
-    p = subprocess.Popen([os.getenv('BF_RUN','./jit-x64'), program] + sys.argv[1:], stdout=subprocess.PIPE, stdin=subprocess.PIPE)
+    cmd = [os.getenv('BF_RUN','./jit-x64'), program] + sys.argv[1:]
+    if perfstat:
+        cmd = [perfstat] + cmd
+    p = subprocess.Popen(cmd, stdout=subprocess.PIPE, stdin=subprocess.PIPE,
+                         stderr=subprocess.PIPE)
     start = time.time()
-    output = p.communicate(input=stdin + '\x00')[0]
-    return output, time.time() - start
+    output, errors = p.communicate(input=stdin + '\x00')
+    elapsed = time.time() - start
+    counters = {}
+    for line in errors.splitlines():
+        if line.startswith('perfstat: '):
+            name, count = line.split()[1:]
+            counters[name] = float(count)
+        else:
+            sys.stderr.write(line + '\n')
+    return output, elapsed, counters
+
+def format_counters(c):
+    fields = []
+    if 'cycles' in c:
+        fields.append('%.0fM cycles' % (c['cycles'] / 1e6))
+    if 'instructions' in c:
+        fields.append('%.0fM insns' % (c['instructions'] / 1e6))
+    if c.get('cycles') and 'instructions' in c:
+        fields.append('IPC %.2f' % (c['instructions'] / c['cycles']))
+    if 'branch-misses' in c:
+        miss = '%.2fM br-miss' % (c['branch-misses'] / 1e6)
+        if c.get('branches'):
+            miss += ' (%.2f%%)' % (100 * c['branch-misses'] / c['branches'])
+        fields.append(miss)
+    if 'L1i-misses' in c:
+        fields.append('%.2fM L1i-miss' % (c['L1i-misses'] / 1e6))
+    return '\t'.join(fields)
 
 expected_output_hashes = {
     'progs/mandelbrot.b': 'b77a017f811831f0b74e0d69c08b78e620dbda2b',
@@ -22,11 +57,11 @@ for filename, expected_hash in expected_output_hashes.iteritems():
     stdin = ''
     if isinstance(filename, tuple):
         filename, stdin = filename
-    output, elapsed = get_output(filename, stdin)
+    output, elapsed, counters = get_output(filename, stdin)
     actual_hash = hashlib.sha1(output).hexdigest()
     print filename.ljust(24),
     if actual_hash == expected_hash:
-        print 'GOOD\t%.1fms' % (elapsed * 1000)
+        print 'GOOD\t%.1fms\t%s' % (elapsed * 1000, format_counters(counters))
     else:
         print "bad output: expected %s got %s" % (
             expected_hash, actual_hash)
@@ -0,0 +1,97 @@
+// Runs a command and reports hardware performance counters for it on
+// stderr, one "perfstat: <event> <count>" line per event.  Events the
+// kernel or CPU does not support are left out.  The command's stdin,
+// stdout and exit status pass through.
+//
+// Usage: perfstat <command> [args...]
+
+#include <linux/perf_event.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#define L1I_MISS (PERF_COUNT_HW_CACHE_L1I | \
+                  (PERF_COUNT_HW_CACHE_OP_READ << 8) | \
+                  (PERF_COUNT_HW_CACHE_RESULT_MISS << 16))
+
+static const struct {
+	const char *name;
+	uint32_t type;
+	uint64_t config;
+} events[] = {
+	{ "cycles", PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES },
+	{ "instructions", PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS },
+	{ "branches", PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_INSTRUCTIONS },
+	{ "branch-misses", PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES },
+	{ "L1i-misses", PERF_TYPE_HW_CACHE, L1I_MISS },
+};
+#define NUM_EVENTS (int) (sizeof(events) / sizeof(events[0]))
+
+static int open_counter(const int i, const pid_t pid)
+{
+	struct perf_event_attr attr;
+	memset(&attr, 0, sizeof(attr));
+	attr.size = sizeof(attr);
+	attr.type = events[i].type;
+	attr.config = events[i].config;
+	attr.disabled = 1;
+	attr.enable_on_exec = 1;
+	attr.inherit = 1;
+	attr.exclude_kernel = 1;
+	attr.exclude_hv = 1;
+	attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED |
+	                   PERF_FORMAT_TOTAL_TIME_RUNNING;
+	return syscall(SYS_perf_event_open, &attr, pid, -1, -1, 0);
+}
+
+int main(int argc, char *argv[])
+{
+	if (argc < 2) {
+		fprintf(stderr, "Usage: perfstat <command> [args...]\n");
+		return 1;
+	}
+
+	// The child waits for the counters to be attached before it execs;
+	// they start counting at the exec.
+	int go[2];
+	if (pipe(go)) return 1;
+	pid_t pid = fork();
+	if (pid < 0) return 1;
+	if (pid == 0) {
+		char c;
+		close(go[1]);
+		if (read(go[0], &c, 1) != 1) _exit(127);
+		close(go[0]);
+		execvp(argv[1], argv + 1);
+		perror(argv[1]);
+		_exit(127);
+	}
+
+	int fds[NUM_EVENTS];
+	for (int i = 0; i < NUM_EVENTS; i++)
+		fds[i] = open_counter(i, pid);
+	close(go[0]);
+	if (write(go[1], "x", 1) != 1) return 1;
+	close(go[1]);
+
+	int status;
+	if (waitpid(pid, &status, 0) < 0) return 1;
+
+	for (int i = 0; i < NUM_EVENTS; i++) {
+		uint64_t v[3]; // value, time enabled, time running
+		if (fds[i] < 0) continue;
+		if (read(fds[i], v, sizeof(v)) == sizeof(v) && v[2]) {
+			// Scale up if the counter was multiplexed.
+			double count = (double) v[0] * v[1] / v[2];
+			fprintf(stderr, "perfstat: %s %.0f\n",
+			        events[i].name, count);
+		}
+		close(fds[i]);
+	}
+	return WIFEXITED(status) ? WEXITSTATUS(status) : 128 + WTERMSIG(status);
+}
@@ -0,0 +1,35 @@
+// Helpers for tests that run the tools in the tree.  The tests run from
+// the top of the tree, and keep their scratch files in /tmp.
+
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/wait.h>
+
+// Most output a command may produce.
+#define RUN_OUTPUT (1 << 16)
+
+// Runs command through the shell, storing its output in out, which holds
+// RUN_OUTPUT bytes, and the length of it in *len.  Returns the exit
+// status, or 128 plus the signal that killed it, as the shell does.
+static inline
+int run(const char * const command, char * const out, size_t * const len)
+{
+	FILE *fp = popen(command, "r");
+	assert(fp != NULL);
+	*len = fread(out, 1, RUN_OUTPUT, fp);
+	int status = pclose(fp);
+	assert(status != -1);
+	return WIFEXITED(status) ? WEXITSTATUS(status)
+	                         : 128 + WTERMSIG(status);
+}
+
+static inline
+void write_file(const char * const filename, const char * const contents)
+{
+	FILE *fp = fopen(filename, "w");
+	assert(fp != NULL);
+	fputs(contents, fp);
+	assert(fclose(fp) == 0);
+}
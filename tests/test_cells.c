@@ -0,0 +1,61 @@
+#include "run.h"
+
+// Checks jit-x64 against the interpreter on balanced inner loops that
+// touch more cells than it keeps in registers, so some cells live in
+// registers and the rest stay on the tape, with I/O inside the loops
+// and at their exits.
+
+#define PROGRAM "/tmp/test_cells.b"
+#define INPUT "abcdefghijklmnopqrst"
+
+// Compares the output of program under jit-x64, plain and sandboxed,
+// with the interpreter's.
+static void compare(const char * const program)
+{
+	static const char * const tools[] = {
+		"./jit-x64", "./jit-x64 -s 1000000",
+	};
+	static char expected[RUN_OUTPUT], out[RUN_OUTPUT];
+	char command[256];
+	size_t expected_len, len;
+
+	write_file(PROGRAM, program);
+	assert(run("printf '" INPUT "' | ./interpreter " PROGRAM,
+	           expected, &expected_len) == 0);
+	for (size_t i = 0; i < sizeof(tools) / sizeof(tools[0]); i++) {
+		snprintf(command, sizeof(command),
+		         "printf '" INPUT "' | %s " PROGRAM, tools[i]);
+		assert(run(command, out, &len) == 0);
+		assert(len == expected_len && !memcmp(out, expected, len));
+	}
+}
+
+int main () {
+	puts("testing ten cells, written out after the loop");
+	compare("++++++++["
+	        ">+>++>+++>++++>+++++>++++++>+++++++>++++++++>+++++++++"
+	        ">++++++++++<<<<<<<<<<-]"
+	        ">.>.>.>.>.>.>.>.>.>.");
+
+	puts("testing thirteen cells either side, with I/O in the loop");
+	compare(">>>>>>>>>>++++++++++["
+	        "<+<++<+<.>>>>"         // -1 to -4
+	        "<<<<<<<<<+>>>>>>>>>"   // -9
+	        ">>+++<<-"              // 2, and the counter
+	        "<<<<<.>>>>>"           // -5
+	        ">>>,<<<"               // 3
+	        "<<<<<<<->>>>>>>"       // -7
+	        "<<<<<<+>>>>>>"         // -6
+	        "<<<<<<<<+>>>>>>>>"     // -8
+	        ">>>>+<<<<"             // 4
+	        "]"
+	        "<<<<<<<<<.>.>.>.>.>.>.>.>.>.>.>.>.>.");
+
+	puts("testing an inner loop in an outer one, written out at its exit");
+	compare("++++[>+++["
+	        ">+>++>+>+++>+>++>+>+++>+<<<<<<<<<-]"
+	        ">>>>>>>>>.<<<<<<<<<<-]");
+
+	remove(PROGRAM);
+	puts("tests pass");
+}
@@ -0,0 +1,129 @@
+#include <signal.h>
+#include <unistd.h>
+#include "run.h"
+
+// Stops the interpreter and jit-x64 with SIGTERM while they run with -c,
+// resumes them from the checkpoint with -r, and checks the output comes
+// out as if they had never stopped.
+
+#define PROGRAM "/tmp/test_checkpoint.b"
+#define CHECKPOINT "/tmp/test_checkpoint.ck"
+#define INPUT "x"
+
+#define P10 "++++++++++"
+#define P40 P10 P10 P10 P10
+
+// Starts command through the shell with pipes to its input and from its
+// output.  Returns its pid.
+static pid_t start(const char * const command, int * const in,
+                   int * const out)
+{
+	int to[2], from[2];
+	assert(!pipe(to) && !pipe(from));
+	pid_t pid = fork();
+	assert(pid >= 0);
+	if (pid == 0) {
+		dup2(to[0], STDIN_FILENO);
+		dup2(from[1], STDOUT_FILENO);
+		close(to[0]);
+		close(to[1]);
+		close(from[0]);
+		close(from[1]);
+		execl("/bin/sh", "sh", "-c", command, (char *) NULL);
+		_exit(127);
+	}
+	close(to[0]);
+	close(from[1]);
+	*in = to[1];
+	*out = from[0];
+	return pid;
+}
+
+// Waits until pid has a handler for sig, then until it blocks, which
+// the programs here only do reading input.
+static void wait_for_read(const pid_t pid, const int sig)
+{
+	char filename[64], line[256], state = 0;
+	unsigned long long caught = 0;
+	snprintf(filename, sizeof(filename), "/proc/%d/status", (int) pid);
+	while (!(caught & 1ULL << (sig - 1)) || state != 'S') {
+		usleep(1000);
+		FILE *fp = fopen(filename, "r");
+		assert(fp != NULL);
+		while (fgets(line, sizeof(line), fp)) {
+			sscanf(line, "SigCgt: %llx", &caught);
+			sscanf(line, "State: %c", &state);
+		}
+		fclose(fp);
+		assert(state != 'Z');
+	}
+}
+
+// Runs tool on program, which waits for input halfway.  Stops it with
+// SIGTERM while it waits, so the checkpoint comes at the first back-edge
+// after the input, then resumes it and checks the output up to the
+// checkpoint and the output after it make up that of an uninterrupted
+// run.
+static void round_trip(const char * const tool, const char * const program)
+{
+	static char expected[RUN_OUTPUT], out[RUN_OUTPUT];
+	char command[512];
+	size_t expected_len, len = 0;
+	int in, from;
+
+	snprintf(command, sizeof(command),
+	         "printf " INPUT " | %s %s", tool, program);
+	assert(run(command, expected, &expected_len) == 0);
+
+	remove(CHECKPOINT);
+	snprintf(command, sizeof(command),
+	         "exec %s -c " CHECKPOINT " %s", tool, program);
+	pid_t pid = start(command, &in, &from);
+	wait_for_read(pid, SIGTERM);
+	assert(kill(pid, SIGTERM) == 0);
+	assert(write(in, INPUT, 1) == 1);
+	close(in);
+	ssize_t n;
+	while ((n = read(from, out + len, sizeof(out) - len)) > 0)
+		len += n;
+	close(from);
+	int status;
+	assert(waitpid(pid, &status, 0) == pid);
+	assert(WIFEXITED(status) && WEXITSTATUS(status) == 75);
+	assert(len >= 13 && !memcmp(out, "ABCDEFGHIJKLM", 13));
+
+	snprintf(command, sizeof(command),
+	         "printf " INPUT " | %s -c " CHECKPOINT " -r " CHECKPOINT " %s",
+	         tool, program);
+	size_t rest;
+	assert(run(command, out + len, &rest) == 0);
+	len += rest;
+	assert(len == expected_len && !memcmp(out, expected, len));
+}
+
+int main () {
+	// Prints A to Z, busy for a while between letters, and reads a byte
+	// after M.
+	const char * const program =
+	    "++++++++[>++++++++<-]"       // 64 in cell 1
+	    "+++++++++++++"               // 13 letters
+	    "[>+."
+	    ">" P40 "[>" P40 "[>" P40 "[-]<-]<-]<"
+	    "<-]"
+	    ">>>>>,<<<<<"                 // the byte, in cell 5
+	    "+++++++++++++"               // 13 more
+	    "[>+."
+	    ">" P40 "[>" P40 "[>" P40 "[-]<-]<-]<"
+	    "<-]";
+	write_file(PROGRAM, program);
+
+	puts("testing interpreter checkpoint round trip");
+	round_trip("./interpreter", PROGRAM);
+
+	puts("testing jit-x64 checkpoint round trip");
+	round_trip("./jit-x64", PROGRAM);
+
+	remove(PROGRAM);
+	remove(CHECKPOINT);
+	puts("tests pass");
+}
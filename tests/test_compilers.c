@@ -0,0 +1,87 @@
+#include <dlfcn.h>
+#include "run.h"
+#include "bf-run.h"
+
+// Checks compiler-x64's standalone (-s) and shared object (-l) output
+// against the interpreter, on the sample programs and on input.
+
+#define ASSEMBLY "/tmp/test_compilers.s"
+#define BINARY "/tmp/test_compilers"
+#define LIBRARY "/tmp/test_compilers.so"
+#define ECHO "/tmp/test_compilers.b"
+#define INPUT "Hello, input\n"
+
+struct buffer {
+	const char *in;
+	char out[RUN_OUTPUT];
+	size_t len;
+};
+
+static void put(int c, void *ctx)
+{
+	struct buffer *b = ctx;
+	assert(b->len < sizeof(b->out));
+	b->out[b->len++] = c;
+}
+
+static int get(void *ctx)
+{
+	struct buffer *b = ctx;
+	return *b->in ? (unsigned char) *b->in++ : EOF;
+}
+
+// Compares the output of program under every mode with the interpreter's.
+static void compare(const char * const program)
+{
+	static char expected[RUN_OUTPUT], out[RUN_OUTPUT];
+	char command[512];
+	size_t expected_len, len;
+
+	snprintf(command, sizeof(command),
+	         "printf '" INPUT "' | ./interpreter %s", program);
+	assert(run(command, expected, &expected_len) == 0);
+
+	snprintf(command, sizeof(command),
+	         "./compiler-x64 -s %s > " ASSEMBLY " && "
+	         "cc -nostdlib -static -o " BINARY " " ASSEMBLY " && "
+	         "printf '" INPUT "' | " BINARY, program);
+	assert(run(command, out, &len) == 0);
+	assert(len == expected_len && !memcmp(out, expected, len));
+
+	snprintf(command, sizeof(command),
+	         "./compiler-x64 -l %s > " ASSEMBLY " && "
+	         "cc -shared -o " LIBRARY " " ASSEMBLY, program);
+	assert(run(command, out, &len) == 0);
+	void *handle = dlopen(LIBRARY, RTLD_NOW | RTLD_LOCAL);
+	assert(handle != NULL);
+	bf_run_fn bf = (bf_run_fn) dlsym(handle, "bf_run");
+	assert(bf != NULL);
+	static struct buffer b;
+	static uint8_t tape[30000];
+	const struct bf_io io = { .put = put, .get = get, .ctx = &b };
+	b.in = INPUT;
+	b.len = 0;
+	memset(tape, 0, sizeof(tape));
+	bf(tape, &io);
+	dlclose(handle);
+	assert(b.len == expected_len && !memcmp(b.out, expected, b.len));
+}
+
+int main () {
+	puts("testing hello");
+	compare("progs/hello.b");
+
+	puts("testing sierpinski");
+	compare("progs/sierpinski.b");
+
+	puts("testing input to end of file");
+	// EOF reads as 255, which the + turns into 0 to end the loop.
+	write_file(ECHO, ",+[-.,+]");
+	compare(ECHO);
+
+	remove(ECHO);
+	remove(ASSEMBLY);
+	remove(BINARY);
+	remove(LIBRARY);
+	puts("tests pass");
+}
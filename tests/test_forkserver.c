@@ -0,0 +1,59 @@
+#include "run.h"
+
+// Runs requests through jit-x64's fork server (-f): each child gets its
+// own input and output file and its own copy of the tape, and the server
+// reports each child's status and keeps serving whatever happens to it.
+
+#define PROGRAM "/tmp/test_forkserver.b"
+#define IN(n) "/tmp/test_forkserver" #n ".in"
+#define OUT(n) "/tmp/test_forkserver" #n ".out"
+
+// Checks that filename holds exactly contents.
+static void check_file(const char * const filename,
+                       const char * const contents)
+{
+	static char buf[RUN_OUTPUT];
+	FILE *fp = fopen(filename, "r");
+	assert(fp != NULL);
+	size_t len = fread(buf, 1, sizeof(buf), fp);
+	fclose(fp);
+	assert(len == strlen(contents) && !memcmp(buf, contents, len));
+}
+
+int main () {
+	static char out[RUN_OUTPUT];
+	size_t len;
+
+	// Writes out its first line reversed.  Input without a newline sends
+	// it off the end of the tape: end of file reads as 255.
+	write_file(PROGRAM, ">,----------[>,----------]<[++++++++++.<]");
+	write_file(IN(1), "abc\n");
+	write_file(IN(3), "no newline");
+	write_file(IN(4), "hello\nworld\n");
+	remove(IN(2));
+
+	puts("testing requests");
+	assert(run("printf '"
+	           IN(1) " " OUT(1) "\\n"
+	           IN(2) " " OUT(2) "\\n"
+	           IN(3) " " OUT(3) "\\n"
+	           IN(4) " " OUT(4) "\\n"
+	           "' | ./jit-x64 -f " PROGRAM, out, &len) == 0);
+	// The missing input file fails its child, and running off the tape
+	// kills its child with SIGSEGV; the requests after are still served.
+	assert(len == 10 && !memcmp(out, "0\n1\n139\n0\n", len));
+
+	puts("testing each child's output");
+	check_file(OUT(1), "cba");
+	check_file(OUT(4), "olleh");
+
+	remove(PROGRAM);
+	remove(IN(1));
+	remove(IN(3));
+	remove(IN(4));
+	remove(OUT(1));
+	remove(OUT(2));
+	remove(OUT(3));
+	remove(OUT(4));
+	puts("tests pass");
+}
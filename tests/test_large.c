@@ -0,0 +1,46 @@
+#include "run.h"
+
+// Runs jit-x64 on a program too large for one DynASM section: it must
+// fail cleanly rather than crash.
+
+#define PROGRAM "/tmp/test_large.b"
+
+// Writes a program that reads two cells, adds reps to each, and writes
+// them out in reverse order.
+static void write_program(const long reps)
+{
+	FILE *fp = fopen(PROGRAM, "w");
+	assert(fp != NULL);
+	fputs(",>,<", fp);
+	for (long i = 0; i < reps; i++)
+		fputs(">+<+", fp);
+	fputs(">.<.", fp);
+	assert(fclose(fp) == 0);
+}
+
+int main () {
+	static char out[RUN_OUTPUT];
+	size_t len;
+
+	puts("testing a program that fits");
+	write_program(1000000);
+	assert(run("printf AB | ./jit-x64 " PROGRAM, out, &len) == 0);
+	// 1000000 % 256 == 64
+	assert(len == 2);
+	assert(out[0] == (char) ('B' + 64) && out[1] == (char) ('A' + 64));
+
+	puts("testing a program past the section limit");
+	write_program(3000000);
+	assert(run("printf AB | ./jit-x64 " PROGRAM " 2>/dev/null",
+	           out, &len) == 1);
+	assert(len == 0);
+
+	puts("testing background compilation falling back to interpreting");
+	assert(run("printf AB | ./jit-x64 -a " PROGRAM, out, &len) == 0);
+	// 3000000 % 256 == 192
+	assert(len == 2);
+	assert(out[0] == (char) ('B' + 192) && out[1] == (char) ('A' + 192));
+
+	remove(PROGRAM);
+	puts("tests pass");
+}
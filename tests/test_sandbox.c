@@ -0,0 +1,52 @@
+#include "run.h"
+
+// Runs programs in jit-x64's sandbox (-s <fuel>): exit status 2 when
+// they run out of fuel, 3 when the pointer leaves the tape.
+
+#define PROGRAM "/tmp/test_sandbox.b"
+
+static int sandboxed(const char * const program, const char * const fuel,
+                     char * const out, size_t * const len)
+{
+	char command[256];
+	write_file(PROGRAM, program);
+	snprintf(command, sizeof(command),
+	         "./jit-x64 -s %s " PROGRAM " </dev/null 2>/dev/null", fuel);
+	return run(command, out, len);
+}
+
+int main () {
+	static char out[RUN_OUTPUT];
+	size_t len;
+
+	puts("testing a program that finishes");
+	assert(sandboxed("++++++++[>++++++++<-]>+.", "1000", out, &len) == 0);
+	assert(len == 1 && out[0] == 'A');
+
+	puts("testing running out of fuel");
+	assert(sandboxed("+[]", "1000", out, &len) == 2);
+	assert(sandboxed("+[>+<]", "1000000", out, &len) == 2);
+	// Output before the fuel ran out is kept.
+	assert(sandboxed("++++++++[>++++++++<-]>+.+[]", "1000",
+	                 out, &len) == 2);
+	assert(len == 1 && out[0] == 'A');
+
+	puts("testing leaving the tape");
+	assert(sandboxed("+[>+]", "1000000000", out, &len) == 3);
+	assert(sandboxed("+[<+]", "1000000000", out, &len) == 3);
+	// Running off the end is caught exactly, one cell past the tape.
+	static char program[30000 + 2];
+	memset(program, '>', 29999);
+	program[29999] = '+';
+	assert(sandboxed(program, "1000", out, &len) == 0);
+	memset(program, '>', 30000);
+	program[30000] = '+';
+	assert(sandboxed(program, "1000", out, &len) == 3);
+
+	puts("testing hello world");
+	assert(run("./jit-x64 -s 1000000 progs/hello.b", out, &len) == 0);
+	assert(len == 13 && !memcmp(out, "Hello World!\n", len));
+
+	remove(PROGRAM);
+	puts("tests pass");
+}
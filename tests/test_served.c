@@ -0,0 +1,65 @@
+#include <signal.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "run.h"
+
+// Runs programs on jit-x64's daemon (-d <socket>) through bf-client:
+// programs that crash, loop or leave the tape get an error reply, and
+// the daemon keeps serving.
+
+#define SOCKET "/tmp/test_served.sock"
+#define PROGRAM "/tmp/test_served.b"
+
+static int served(const char * const program, const char * const input,
+                  char * const out, size_t * const len)
+{
+	char command[256];
+	write_file(PROGRAM, program);
+	snprintf(command, sizeof(command),
+	         "printf '%s' | BF_SERVED=" SOCKET " ./bf-client " PROGRAM
+	         " 2>&1", input);
+	return run(command, out, len);
+}
+
+int main () {
+	static char out[RUN_OUTPUT];
+	size_t len;
+
+	remove(SOCKET);
+	assert(run("./jit-x64 -d " SOCKET " -j 2 -s 1000000 "
+	           ">/dev/null 2>&1 & echo $!", out, &len) == 0);
+	const pid_t daemon = atoi(out);
+	struct stat st;
+	while (stat(SOCKET, &st) || !S_ISSOCK(st.st_mode))
+		usleep(10000);
+
+	puts("testing a program that finishes");
+	assert(served("++++++++[>++++++++<-]>+.", "", out, &len) == 0);
+	assert(len == 1 && out[0] == 'A');
+
+	puts("testing input");
+	// EOF reads as 255, which the + turns into 0 to end the loop.
+	assert(served(",+[-.,+]", "echo", out, &len) == 0);
+	assert(len == 4 && !memcmp(out, "echo", len));
+
+	puts("testing errors");
+	assert(served("[", "", out, &len) == 1);
+	assert(len == 25 && !memcmp(out, "Couldn't compile program\n", len));
+	assert(served("+[>+]", "", out, &len) == 1);
+	assert(len == 22 && !memcmp(out, "Pointer left the tape\n", len));
+	assert(served("+[]", "", out, &len) == 1);
+	assert(len == 12 && !memcmp(out, "Out of fuel\n", len));
+	// Output before the fuel ran out is kept.
+	assert(served("++++++++[>++++++++<-]>+.+[]", "", out, &len) == 1);
+	assert(len == 13 && !memcmp(out, "AOut of fuel\n", len));
+
+	puts("testing the daemon is still serving");
+	assert(run("BF_SERVED=" SOCKET " ./bf-client progs/hello.b",
+	           out, &len) == 0);
+	assert(len == 13 && !memcmp(out, "Hello World!\n", len));
+
+	kill(daemon, SIGTERM);
+	remove(SOCKET);
+	remove(PROGRAM);
+	puts("tests pass");
+}
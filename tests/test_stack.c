@@ -5,7 +5,7 @@
 #define GUARD(expr) assert(!(expr))
 
 int main () {
-	struct stack stack = { .size = 0, .items = { 0 } };
+	struct stack stack = { .size = 0, .items = NULL };
 
 	puts("testing STACKSIZE");
 	assert(STACKSIZE == 100);
@@ -42,5 +42,20 @@ int main () {
 	assert(stack.size == 0);
 	assert(stack.items != NULL);
 
+	puts("testing growth past STACKSIZE");
+	for (int i = 0; i < STACKSIZE * 10; i++)
+		GUARD(stack_push(&stack, i));
+	assert(stack.size == STACKSIZE * 10);
+	assert(stack.capacity >= stack.size);
+	for (int i = STACKSIZE * 10 - 1; i >= 0; i--) {
+		GUARD(stack_pop(&stack, &x));
+		assert(x == i);
+	}
+	assert(stack.size == 0);
+
+	stack_free(&stack);
+	assert(stack.items == NULL);
+	assert(stack.capacity == 0);
+
 	puts("tests pass");
 }
@@ -0,0 +1,104 @@
+// Trace mode (experimental): instead of compiling the whole program up
+// front, interprets it and compiles the paths it actually takes.
+//
+// Every place a loop test jumps to is counted.  Once one has been reached
+// TRACE_HOT times, the interpreter records the operations it runs from
+// there, following inner loops and branches as they go, until it comes
+// back to the start (the trace loops), reaches the start of another
+// trace (the trace jumps to it), or has recorded TRACE_MAX operations.
+// The recording is compiled into straight-line code with a guard at each
+// loop test it passed: when a test goes the other way, the trace exits.
+// Exits jump straight into the trace starting where they lead, if there
+// is one, and otherwise return to the interpreter, which counts them
+// like any other jump so that hot exits grow traces of their own.
+//
+// The including JIT provides compile_trace().
+
+#include <limits.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+// Jumps to a place before a trace is recorded there.
+#define TRACE_HOT 50
+// Longest trace, in operations.
+#define TRACE_MAX 4096
+
+// A trace takes a pointer to the cell pointer, which it updates, and the
+// streams, and returns the operation to go on with.
+typedef int (*trace_fn)(uint8_t **ptr, FILE *in, FILE *out);
+
+// An operation run during recording, and the one that ran next.
+struct trace_op {
+	int pc;
+	int next;
+};
+
+// Compiles the len operations in rec.  Exits look up where to go in
+// links, which holds the start of the body of the trace for each pc, or
+// NULL.  Stores the start of this trace's body into *body.  Returns NULL
+// if there is no room for the code.
+static trace_fn compile_trace(const struct ir_prog * const prog,
+                              const struct trace_op * const rec,
+                              const int len, void ** const links,
+                              void ** const body);
+
+// Runs one operation at pc, exiting if the pointer leaves the tape.
+// Returns the next pc.
+static int trace_step(const struct ir_prog * const prog, const int pc,
+                      uint8_t * const tape, uint8_t ** const ptr)
+{
+	long steps = 1;
+	int next = ir_eval(prog, pc, tape, 30000, ptr, stdin, stdout, &steps);
+	if (steps) err("Pointer left the tape");
+	return next;
+}
+
+// Runs prog on tape from the start, recording and compiling traces.
+static void trace_run(const struct ir_prog * const prog, uint8_t * const tape)
+{
+	void **links = calloc(prog->len + 1, sizeof(void *));
+	trace_fn *traces = calloc(prog->len + 1, sizeof(trace_fn));
+	int *hits = calloc(prog->len + 1, sizeof(int));
+	struct trace_op *rec = malloc(TRACE_MAX * sizeof(*rec));
+	if (!links || !traces || !hits || !rec) err("Out of memory");
+
+	uint8_t *ptr = tape;
+	int pc = 0;
+	while (pc < prog->len) {
+		if (traces[pc]) {
+			pc = traces[pc](&ptr, stdin, stdout);
+			hits[pc]++;
+			continue;
+		}
+		if (hits[pc] >= TRACE_HOT) {
+			// Record, running the program as it goes.
+			const int start = pc;
+			int len = 0;
+			do {
+				rec[len].pc = pc;
+				pc = rec[len++].next = trace_step(prog, pc, tape,
+				                                  &ptr);
+			} while (pc != start && pc < prog->len &&
+			         !traces[pc] && len < TRACE_MAX);
+			void *body;
+			traces[start] = compile_trace(prog, rec, len, links,
+			                              &body);
+			links[start] = body;
+			// Without room for the trace, stay interpreting.
+			if (traces[start] == NULL) hits[start] = INT_MIN;
+			continue;
+		}
+		const enum ir_op op = prog->ops[pc].op;
+		pc = trace_step(prog, pc, tape, &ptr);
+		if (op == IR_OPEN || op == IR_CLOSE)
+			hits[pc]++;
+	}
+
+	for (int i = 0; i < prog->len; i++)
+		if (traces[i]) free_jitcode(traces[i]);
+	free(rec);
+	free(hits);
+	free(traces);
+	free(links);
+}
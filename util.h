@@ -1,4 +1,5 @@
 #include <assert.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 
@@ -11,6 +12,8 @@ void err(const char * const msg)
 }
 
 // returns a heap allocated string, caller needs to free
+// (for programs that need random access to the source; the compilers
+// stream it with open_source instead)
 static inline
 char *read_file(const char * const filename)
 {
@@ -22,27 +25,46 @@ char *read_file(const char * const filename)
 	assert(!fseek(fp, 0, SEEK_END));
 	long file_size = ftell(fp);
 	rewind(fp);
-	size_t code_size = sizeof(char) * file_size;
+	size_t code_size = sizeof(char) * (file_size + 1);
 	char *code = malloc(code_size);
 	if (code == NULL) return NULL;
 
 	fread(code, 1, file_size, fp);
+	code[file_size] = '\0';
 	assert(!fclose(fp));
 	return code;
 }
 
+// FNV-1a hash of len bytes at s, for telling programs apart.
+static inline
+uint64_t hash_bytes(const void * const s, const size_t len)
+{
+	uint64_t h = 14695981039346656037ULL;
+	for (size_t i = 0; i < len; i++)
+		h = (h ^ ((const uint8_t *) s)[i]) * 1099511628211ULL;
+	return h;
+}
+
+// Initial capacity of a stack; it doubles whenever it fills up.
 #define STACKSIZE 100
 
 struct stack {
 	int size;
-	int items [STACKSIZE];
+	int capacity;
+	int *items;
 };
 
 static inline
 int stack_push(struct stack * const p, const int x)
 {
-	if (p->size == STACKSIZE)
-		return -1;
+	if (p->size == p->capacity) {
+		int capacity = p->capacity ? p->capacity * 2 : STACKSIZE;
+		int *items = realloc(p->items, capacity * sizeof(int));
+		if (items == NULL)
+			return -1;
+		p->items = items;
+		p->capacity = capacity;
+	}
 
 	p->items[p->size++] = x;
 	return 0;
@@ -57,3 +79,25 @@ int stack_pop(struct stack * const p, int *x)
 	*x = p->items[--p->size];
 	return 0;
 }
+
+static inline
+void stack_free(struct stack * const p)
+{
+	free(p->items);
+	p->items = NULL;
+	p->size = p->capacity = 0;
+}
+
+// Opens a source file for streaming through getc(), with a buffer large
+// enough that reading stays cheap on multi-megabyte programs.
+static inline
+FILE *open_source(const char * const filename)
+{
+	if (filename == NULL) return NULL;
+
+	FILE *fp = fopen(filename, "r");
+	if (fp == NULL) return NULL;
+
+	setvbuf(fp, NULL, _IOFBF, 1 << 16);
+	return fp;
+}